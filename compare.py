@@ -0,0 +1,177 @@
+#!/bin/python3
+
+# compare two sets of benchmark records (bench -j) and flag statistically significant regressions
+# usage: compare.py <baseline> <candidate> [--alpha a] [--min-change c] [--all]
+# a set is a .jsonl file or a directory holding them; exits with 1 if anything regressed, so changes can be gated on it
+
+from argparse import ArgumentParser
+from dataclasses import dataclass, field
+from math import exp, lgamma, log, sqrt
+from os import listdir, path
+import json
+import sys
+
+# parameters that make two runs comparable (everything else, like host or run id, may differ)
+config_keys = ['variant', 'threads', 'pattern', 'time', 'enq_batch_min', 'enq_batch_max', 'deq_batch_min', 'deq_batch_max',
+               'batch', 'payload', 'unroll', 'padded', 'backoff', 'backoff_min', 'backoff_max', 'wait_us', 'lat_every', 'placement']
+
+# compared metrics and whether higher is better
+metrics = {
+  'throughput': True,
+  'enq_lat_p50_ns': False,
+  'enq_lat_p99_ns': False,
+  'deq_lat_p50_ns': False,
+  'deq_lat_p99_ns': False,
+}
+
+@dataclass
+class Sample:
+  ops: int = 0
+  duration: float = 0
+  lat: dict = field(default_factory=dict)  # metric -> [weighted sum, samples]
+
+  def add(self, record: dict):
+    self.ops += record['enq_succ'] + record['deq_succ']
+    self.duration = max(self.duration, record['duration'])
+    for m in metrics:
+      if m in record:
+        n = record[m.split('_p')[0] + '_samples']
+        s = self.lat.setdefault(m, [0, 0])
+        s[0] += record[m] * n
+        s[1] += n
+
+  # value of metric in this repetition (per thread percentiles weighted by their samples), None if not measured
+  def value(self, metric: str):
+    if metric == 'throughput':
+      return self.ops / self.duration if self.duration > 0 else None
+    s = self.lat.get(metric)
+    return s[0] / s[1] if s and s[1] > 0 else None
+
+def files(p: str) -> list:
+  if path.isdir(p):
+    return sorted(path.join(p, f) for f in listdir(p) if f.endswith('.jsonl'))
+  return [p]
+
+# read set: config -> (run, rep) -> sample
+def read_set(p: str) -> dict:
+  configs = {}
+  for f in files(p):
+    with open(f) as lines:
+      for n, line in enumerate(lines, 1):
+        if not line.strip():
+          continue
+        try:
+          record = json.loads(line)
+        except json.JSONDecodeError:
+          print(f'WARNING: {f}:{n}: skipping broken record', file=sys.stderr)
+          continue
+        config = tuple(record.get(k) for k in config_keys)
+        samples = configs.setdefault(config, {})
+        samples.setdefault((record['run'], record['rep']), Sample()).add(record)
+  return configs
+
+# continued fraction of the incomplete beta function (Numerical Recipes)
+def betacf(a: float, b: float, x: float) -> float:
+  tiny = 1e-300
+  c = 1.0
+  d = 1.0 - (a + b) * x / (a + 1.0)
+  d = 1.0 / (d if abs(d) > tiny else tiny)
+  h = d
+  for m in range(1, 201):
+    for num in (m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m)), -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1))):
+      d = 1.0 + num * d
+      d = 1.0 / (d if abs(d) > tiny else tiny)
+      c = 1.0 + num / c
+      c = c if abs(c) > tiny else tiny
+      h *= d * c
+    if abs(d * c - 1.0) < 1e-12:
+      break
+  return h
+
+# regularized incomplete beta function
+def betai(a: float, b: float, x: float) -> float:
+  if x <= 0:
+    return 0.0
+  if x >= 1:
+    return 1.0
+  front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1 - x))
+  if x < (a + 1) / (a + b + 2):
+    return front * betacf(a, b, x) / a
+  return 1.0 - front * betacf(b, a, 1 - x) / b
+
+def mean_var(xs: list) -> tuple:
+  m = sum(xs) / len(xs)
+  return m, sum((x - m) ** 2 for x in xs) / (len(xs) - 1)
+
+# two sided p-value of Welch's t-test (unequal variances), None with less than two samples on a side
+def welch(xs: list, ys: list):
+  if len(xs) < 2 or len(ys) < 2:
+    return None
+  mx, vx = mean_var(xs)
+  my, vy = mean_var(ys)
+  se2 = vx / len(xs) + vy / len(ys)
+  if se2 == 0:
+    return 1.0 if mx == my else 0.0
+  t = (my - mx) / sqrt(se2)
+  df = se2 ** 2 / ((vx / len(xs)) ** 2 / (len(xs) - 1) + (vy / len(ys)) ** 2 / (len(ys) - 1))
+  return betai(df / 2, 0.5, df / (df + t * t))
+
+def describe(config: tuple) -> str:
+  c = dict(zip(config_keys, config))
+  s = f'{c["variant"]} n={c["threads"]}'
+  if c['pattern']:
+    s += f' P={c["pattern"]}'
+  if c['enq_batch_min'] == c['enq_batch_max'] and c['deq_batch_min'] == c['deq_batch_max']:
+    s += f' e={c["enq_batch_max"]} d={c["deq_batch_max"]}'
+  else:
+    s += f' e={c["enq_batch_min"]},{c["enq_batch_max"]} d={c["deq_batch_min"]},{c["deq_batch_max"]}'
+  return s
+
+def main() -> int:
+  parser = ArgumentParser(description='flag statistically significant regressions between two sets of bench -j records')
+  parser.add_argument('baseline', help='records of the last known good build (.jsonl file or directory)')
+  parser.add_argument('candidate', help='records of the build to check (.jsonl file or directory)')
+  parser.add_argument('--alpha', type=float, default=0.05, help='significance level (default 0.05)')
+  parser.add_argument('--min-change', type=float, default=0.02, help='smallest relative change that counts (default 0.02)')
+  parser.add_argument('--all', action='store_true', help='print every comparison, not only the significant ones')
+  args = parser.parse_args()
+
+  base = read_set(args.baseline)
+  cand = read_set(args.candidate)
+  regressions = 0
+  improvements = 0
+  untested = 0
+  for config in sorted(set(base) & set(cand), key=lambda c: tuple(str(x) for x in c)):
+    for metric, higher in metrics.items():
+      xs = [v for v in (s.value(metric) for s in base[config].values()) if v is not None]
+      ys = [v for v in (s.value(metric) for s in cand[config].values()) if v is not None]
+      if not xs or not ys:
+        continue
+      mx = sum(xs) / len(xs)
+      my = sum(ys) / len(ys)
+      change = (my - mx) / mx if mx != 0 else 0.0
+      p = welch(xs, ys)
+      worse = change < 0 if higher else change > 0
+      relevant = abs(change) >= args.min_change
+      if p is None:
+        verdict = 'UNTESTED'
+        untested += relevant
+      elif p < args.alpha and relevant:
+        verdict = 'REGRESSION' if worse else 'IMPROVEMENT'
+      else:
+        verdict = 'same'
+      regressions += verdict == 'REGRESSION'
+      improvements += verdict == 'IMPROVEMENT'
+      if args.all or verdict in ('REGRESSION', 'IMPROVEMENT') or (verdict == 'UNTESTED' and relevant):
+        pv = 'n/a' if p is None else f'{p:.3g}'
+        print(f'{verdict}: {describe(config)} {metric}: {mx:.4g} -> {my:.4g} ({change:+.1%}, p={pv}, {len(xs)} vs {len(ys)} runs)')
+
+  for name, only in (('baseline', set(base) - set(cand)), ('candidate', set(cand) - set(base))):
+    for config in sorted(only, key=lambda c: tuple(str(x) for x in c)):
+      print(f'INFO: only in {name}: {describe(config)}')
+  print(f'INFO: {len(set(base) & set(cand))} configurations compared, {regressions} regressions, {improvements} improvements, '
+        f'{untested} changes with too few runs to test (need -r 2 or more)')
+  return 1 if regressions > 0 else 0
+
+if __name__ == '__main__':
+  sys.exit(main())
@@ -16,7 +16,7 @@ show = False  # show instead of plot as pdf
 
 makedirs(dir_data, exist_ok=True)
 makedirs(dir_plots, exist_ok=True)
-logfiles = listdir(dir_data)
+logfiles = [f for f in listdir(dir_data) if f.endswith('.log')]  # bench -j records are next to them
 
 cm_inch = lambda cm: cm / 2.54
 
@@ -9,6 +9,8 @@ TIMES=$4
 BATCH_SIZES=$5
 THREADS=$6
 PATTERNS=$7
+# thread placement of bench (-p), pinned runs are comparable between hosts
+PLACEMENT=${PLACEMENT:-compact}
 LOG=nebula.log
 DIR_LOC=data
 DIR_NEB=hubble
@@ -83,6 +85,20 @@ run_neb() {
       echo "\$(IFS=,; echo "\${E[*]}")|\$(IFS=,; echo "\${D[*]}")" 
     }
 
+    # thread 0 dequeing, all other threads enqueing
+    e() {
+      local n=\$1 b=\$2
+      local E=() D=()
+      for (( i=0; i<n; i++ )); do
+        if (( i == 0 )); then
+          E+=(0); D+=("\$b")
+        else
+          E+=("\$b"); D+=(0)
+        fi
+      done
+      echo "\$(IFS=,; echo "\${E[*]}")|\$(IFS=,; echo "\${D[*]}")"
+    }
+
     times=($TIMES)
     threads=($THREADS)
     batch_sizes=($BATCH_SIZES)
@@ -97,7 +113,7 @@ run_neb() {
               E=\$(a "\$n" "\$b")
               D=\$(a "\$n" "\$b")
             else
-              tmp=\$(b "\$n" "\$b")
+              tmp=\$(\$pat "\$n" "\$b")
               E=\${tmp%%|*}
               D=\${tmp##*|}
             fi
@@ -106,7 +122,7 @@ run_neb() {
 
             echo "'Running \$logfile'"
 
-            srun -t 2 -p q_student $PROG -n "\$n" -t "\$t" -r $REPETITIONS -E "\$E" -D "\$D" | tee "\$logfile"
+            srun -t 2 -p q_student $PROG -n "\$n" -t "\$t" -r $REPETITIONS -E "\$E" -D "\$D" -p $PLACEMENT -j "\${logfile%.log}.jsonl" | tee "\$logfile"
 
             while [ "\$(squeue -u \$(whoami) | wc -l)" -ne 1 ]; do
               squeue
@@ -123,7 +139,7 @@ EOSSH
 }
 
 if [ $# -ne 7 ]; then
-  echo "USAGE: run_nebula_conc.sh <project.zip> <benchmark executable> <repetitions> <times> <batch sizes> <threads> <patterns>"
+  echo "USAGE: [PLACEMENT=<policy>] run_nebula_conc.sh <project.zip> <benchmark executable> <repetitions> <times> <batch sizes> <threads> <patterns>"
   exit 1
 fi
 
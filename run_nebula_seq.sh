@@ -43,7 +43,7 @@ run_neb() {
 
         echo "'Running \$logfile'"
 
-        srun -t 2 -p q_student $PROG -n 1 -t "\$t" -r $REPETITIONS -e "\$b" -d "\$b" | tee "\$logfile"
+        srun -t 2 -p q_student $PROG -n 1 -t "\$t" -r $REPETITIONS -e "\$b" -d "\$b" -j "\${logfile%.log}.jsonl" | tee "\$logfile"
 
         while [ "\$(squeue -u \$(whoami) | wc -l)" -ne 1 ]; do
           squeue
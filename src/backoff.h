@@ -0,0 +1,142 @@
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "queue.h"
+#include <omp.h>
+
+// backoff policies after a failed CAS
+#define BACKOFF_NONE     0  // retry right away
+#define BACKOFF_EXP      1  // double the wait after every failure
+#define BACKOFF_TRUNC    2  // double the wait up to max
+#define BACKOFF_RAND     3  // random wait below a bound that doubles up to max
+#define BACKOFF_ADAPTIVE 4  // wait between min and max, scaled by the running failure ratio
+
+// default policy and wait bounds in spins (build with e.g. -DBACKOFF=BACKOFF_RAND, bench -B overrides them)
+#ifndef BACKOFF
+#define BACKOFF BACKOFF_NONE
+#endif
+#ifndef BACKOFF_MIN
+#define BACKOFF_MIN 4
+#endif
+#ifndef BACKOFF_MAX
+#define BACKOFF_MAX 1024
+#endif
+
+// bound of the untruncated exponential policy (keeps the wait from overflowing)
+#define BACKOFF_LIMIT (1 << 24)
+
+// failure ratio of the adaptive policy is fixed point (BACKOFF_ONE: every CAS fails)
+#define BACKOFF_ONE 1024
+
+// backoff settings
+typedef struct backoff_config {
+  int policy;
+  int min;
+  int max;
+} backoff_config;
+
+// settings of every queue in the binary (weak, so that every variant can include this header)
+__attribute__((weak)) backoff_config backoff_conf = { BACKOFF, BACKOFF_MIN, BACKOFF_MAX };
+
+// names of the policies (indexed by policy)
+static const char *backoff_names[] = { "none", "exp", "trunc", "rand", "adaptive" };
+
+// per thread backoff state
+typedef struct backoff {
+  PADDED int limit;
+  int ratio;
+  unsigned seed;
+} backoff;
+
+// parse policy[,min,max] (returns 0 on success)
+static int backoff_parse(const char *arg) {
+  for (int p = 0; p < (int)(sizeof(backoff_names) / sizeof(backoff_names[0])); p++) {
+    size_t n = strlen(backoff_names[p]);
+    if (strncmp(arg, backoff_names[p], n) != 0 || (arg[n] != '\0' && arg[n] != ',')) { continue; }
+    backoff_conf.policy = p;
+    if (arg[n] == ',' && sscanf(arg + n + 1, "%d,%d", &backoff_conf.min, &backoff_conf.max) != 2) { return 1; }
+    return backoff_conf.min < 1 || backoff_conf.min > backoff_conf.max;
+  }
+  return 1;
+}
+
+// allocate backoff state for every thread (NULL if out of memory)
+static backoff *backoff_create(int max_threads) {
+  backoff *bs = (backoff*)calloc_padded(max_threads, sizeof(backoff));
+  if (bs == NULL) { return NULL; }  // buy more RAM
+  for (int i = 0; i < max_threads; i++) {
+    bs[i].limit = backoff_conf.min;
+    bs[i].ratio = 0;
+    bs[i].seed = 2654435761u * (unsigned)(i + 1);
+  }
+  return bs;
+}
+
+// spins of the next wait (moves the bound on)
+static int backoff_next(backoff *b) {
+  const backoff_config *c = &backoff_conf;
+  int w = b->limit;
+  switch (c->policy) {
+    case BACKOFF_EXP:
+      if (b->limit < BACKOFF_LIMIT) { b->limit *= 2; }
+      return w;
+    case BACKOFF_TRUNC:
+      b->limit = b->limit * 2 < c->max ? b->limit * 2 : c->max;
+      return w;
+    case BACKOFF_RAND:
+      b->seed ^= b->seed << 13;
+      b->seed ^= b->seed >> 17;
+      b->seed ^= b->seed << 5;
+      b->limit = b->limit * 2 < c->max ? b->limit * 2 : c->max;
+      return 1 + (int)(b->seed % (unsigned)w);
+    case BACKOFF_ADAPTIVE:
+      w = c->min + (int)((long)(c->max - c->min) * b->ratio / BACKOFF_ONE);
+      b->ratio += (BACKOFF_ONE - b->ratio) >> 3;
+      return w;
+    default:
+      return 0;
+  }
+}
+
+// wait for some spins
+static void backoff_spin(int w) {
+  for (int i = 0; i < w; i++) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#else
+    __asm__ volatile("" ::: "memory");
+#endif
+  }
+}
+
+// CAS failed, wait before the retry
+static void backoff_fail(backoff *b) {
+  backoff_spin(backoff_next(b));
+}
+
+// CAS failed, wait before the retry (including statistics)
+static void backoff_fail_stats(backoff *b, stats *s) {
+  int w = backoff_next(b);
+  if (w == 0) { return; }
+  double start = omp_get_wtime();
+  backoff_spin(w);
+  s->backoff_ns += (long)((omp_get_wtime() - start) * 1e9);
+  s->backoff_waits++;
+  s->backoff_spins += w;
+}
+
+// CAS succeeded (the next failure starts with the smallest wait again, the failure ratio decays)
+static void backoff_succ(backoff *b) {
+  if (backoff_conf.policy == BACKOFF_ADAPTIVE) {
+    b->ratio -= b->ratio >> 3;
+  } else {
+    b->limit = backoff_conf.min;
+  }
+}
+
+#endif
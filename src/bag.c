@@ -0,0 +1,364 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "queue.h"
+#include "slab.h"
+#include "pool.h"
+#include "stamp.h"
+#include "wait.h"
+#include "count.h"
+#include <omp.h>
+
+#define CAS sptr_cas // weak (cmpxchg16b with DWCAS)
+
+// relaxed queue ("bag"): every thread enqueues into a sub-queue of its own and dequeues from it first;
+// once it is empty, the other sub-queues get scanned from a random one on and a batch of values is stolen.
+// there is no order guarantee, not even per producer: leftovers of a steal move to the thief's sub-queue,
+// while another thief may take later values of the same producer from the victim and hand them out first.
+
+// values taken from a victim in one steal (the ones the caller did not ask for go to the own sub-queue)
+#ifndef BAG_STEAL
+#define BAG_STEAL 32
+#endif
+
+_Static_assert(BAG_STEAL > 0, "BAG_STEAL has to be positive");
+
+// stamped node pointer
+typedef sptr snode_ptr;
+
+// node definition
+typedef struct node {
+  value_t value;
+  asptr snext;
+} node;
+
+// get node from stamped node
+static node *get_node(snode_ptr sn) {
+  return (node*)get_ptr(sn);
+}
+
+// point node to next (the stamp keeps counting, so a stale read of a recycled node is noticed)
+static void node_link(node *n, node *next) {
+  sptr_store(&n->snext, stamp(next, get_stamp(sptr_load(&n->snext)) + 1));
+}
+
+// sub-queue of a thread (only its owner enqueues and touches tail, everybody may move head)
+typedef struct shard {
+  PADDED asptr head;
+  PADDED node *tail;
+  unsigned int seed;
+} shard;
+
+// queue definition
+typedef struct queue {
+  shard *shards;
+  pool nodes;
+  slab arena;
+  waiter waiting;
+  counter count;
+  int max_threads;
+} queue;
+
+// get node from the pool, fall back to the slab (including statistics, s may be NULL)
+static node *node_new(queue *q, int id, stats *s) {
+  if (s == NULL) {
+    node *n = (node*)pool_get(&q->nodes, id);
+    return n != NULL ? n : (node*)slab_alloc(&q->arena, id);
+  }
+  node *n = (node*)pool_get_stats(&q->nodes, id, s);
+  return n != NULL ? n : (node*)slab_alloc_stats(&q->arena, id, s);
+}
+
+// hand node back to the pool (including statistics, s may be NULL)
+static void node_free(queue *q, int id, node *n, stats *s) {
+  if (s == NULL) {
+    pool_put(&q->nodes, id, n);
+  } else {
+    pool_put_stats(&q->nodes, id, n, s);
+  }
+}
+
+// append chain first..last to the sub-queue of the calling thread (no CAS, nobody else writes tail)
+static void shard_append(shard *sh, node *first, node *last) {
+  node_link(sh->tail, first);
+  sh->tail = last;
+}
+
+// take up to max values from the head of a sub-queue with one CAS (returns number of taken values);
+// *first and *last are the nodes that got unlinked (they are the callers now)
+static int shard_take(shard *sh, value_t *vs, int max, node **first, node **last, stats *s) {
+  while(1) {
+    snode_ptr shead = sptr_load(&sh->head);
+    node *head = get_node(shead);
+    node *next = get_node(sptr_load(&head->snext));
+    if (next == NULL) { return 0; }
+    // collect values, the head stamp tells whether they are still ours
+    node *new = next;
+    node *prev = head;
+    int c = 0;
+    vs[c++] = new->value;
+    while (c < max) {
+      node *n = get_node(sptr_load(&new->snext));
+      if (n == NULL) { break; }
+      prev = new;
+      new = n;
+      vs[c++] = new->value;
+    }
+    if (CAS(&sh->head, &shead, stamp(new, get_stamp(shead) + 1))) {
+      if (s != NULL) { s->cas_succ++; }
+      *first = head;
+      *last = prev;
+      return c;
+    }
+    if (s != NULL) { s->cas_fail++; }
+  }
+}
+
+// give unlinked nodes first..last (linked through snext) back to the pool
+static void nodes_free(queue *q, int id, node *first, node *last, stats *s) {
+  while (1) {
+    node *next = get_node(sptr_load(&first->snext));
+    node_free(q, id, first, s);
+    if (first == last) { return; }
+    first = next;
+  }
+}
+
+// steal from the other sub-queues, starting at a random one (returns number of values for the caller, 0 if all are empty)
+static int steal(queue *q, value_t *vs, int max, int id, stats *s) {
+  shard *own = &q->shards[id];
+  value_t buf[BAG_STEAL];
+  int start = rand_r(&own->seed) % q->max_threads;
+  for (int i = 0; i < q->max_threads; i++) {
+    int victim = (start + i) % q->max_threads;
+    if (victim == id) { continue; }
+    node *first, *last;
+    int c = shard_take(&q->shards[victim], buf, BAG_STEAL, &first, &last, s);
+    if (c == 0) { continue; }
+    int k = c < max ? c : max;
+    memcpy(vs, buf, k * sizeof(value_t));
+    // the unlinked nodes (one per stolen value) carry the rest over to the own sub-queue
+    node *nd = first;
+    node *head = NULL;
+    node *tail = NULL;
+    for (int j = k; j < c; j++) {
+      node *next = get_node(sptr_load(&nd->snext));
+      nd->value = buf[j];
+      node_link(nd, NULL);
+      if (tail == NULL) { head = nd; } else { node_link(tail, nd); }
+      tail = nd;
+      nd = next;
+    }
+    if (tail != NULL) { shard_append(own, head, tail); }
+    nodes_free(q, id, nd, last, s);
+    if (s != NULL) {
+      s->steals++;
+      s->stolen += c;
+    }
+    return k;
+  }
+  return 0;
+}
+
+// create queue
+queue* create() {
+  queue *q = (queue*)calloc_padded(1, sizeof(queue));
+  if (!q) { return NULL; }  // buy more RAM
+  return q;
+}
+
+// initialize queue
+int init(queue *q) {
+  q->max_threads = omp_get_max_threads();
+  int ret_pool = pool_init(&q->nodes, q->max_threads, &q->arena);
+  int ret_slab = slab_init(&q->arena, sizeof(node), q->max_threads);
+  q->shards = (shard*)calloc_padded(q->max_threads, sizeof(shard));
+  int ret_count = count_init(&q->count, q->max_threads);
+  if (ret_pool != QUEUE_OK || ret_slab != QUEUE_OK || q->shards == NULL || ret_count != QUEUE_OK) {
+    pool_destroy(&q->nodes);
+    slab_destroy(&q->arena);
+    free(q->shards);
+    count_destroy(&q->count);
+    return QUEUE_NOMEM;
+  }  // buy more RAM
+  int id = omp_get_thread_num();
+  for (int i = 0; i < q->max_threads; i++) {
+    node *n = node_new(q, id, NULL);
+    if (n == NULL) {
+      pool_destroy(&q->nodes);
+      slab_destroy(&q->arena);
+      free(q->shards);
+      count_destroy(&q->count);
+      return QUEUE_NOMEM;
+    }  // buy more RAM
+    node_link(n, NULL);
+    sptr_store(&q->shards[i].head, stamp(n, 0));
+    q->shards[i].tail = n;
+    q->shards[i].seed = (unsigned int)(i * 100000 + 1);
+  }
+  wait_init(&q->waiting);
+  return QUEUE_OK;
+}
+
+// enqueue in queue
+int enq(value_t v, queue *q) {
+  int id = omp_get_thread_num();
+  node *n = node_new(q, id, NULL);
+  if (n == NULL) { return QUEUE_NOMEM; }  // buy more RAM
+  n->value = v;
+  node_link(n, NULL);
+  shard_append(&q->shards[id], n, n);
+  count_enq(&q->count, id, 1);
+  wait_wake(&q->waiting, 1);
+  return QUEUE_OK;
+}
+
+// enqueue in queue (including statistics)
+int enq_stats(value_t v, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  node *n = node_new(q, id, s);
+  if (n == NULL) { return QUEUE_NOMEM; }  // buy more RAM
+  n->value = v;
+  node_link(n, NULL);
+  shard_append(&q->shards[id], n, n);
+  count_enq(&q->count, id, 1);
+  wait_wake_stats(&q->waiting, 1, s);
+  return QUEUE_OK;
+}
+
+// dequeue from queue
+int deq(value_t *v, queue *q) {
+  int id = omp_get_thread_num();
+  node *first, *last;
+  if (shard_take(&q->shards[id], v, 1, &first, &last, NULL) == 1) {
+    node_free(q, id, first, NULL);
+    count_deq(&q->count, id, 1);
+    return QUEUE_OK;
+  }
+  if (steal(q, v, 1, id, NULL) == 0) { return QUEUE_EMPTY; }
+  count_deq(&q->count, id, 1);
+  return QUEUE_OK;
+}
+
+// dequeue from queue (including statistics)
+int deq_stats(value_t *v, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  node *first, *last;
+  if (shard_take(&q->shards[id], v, 1, &first, &last, s) == 1) {
+    node_free(q, id, first, s);
+    count_deq(&q->count, id, 1);
+    return QUEUE_OK;
+  }
+  if (steal(q, v, 1, id, s) == 0) { return QUEUE_EMPTY; }
+  count_deq(&q->count, id, 1);
+  return QUEUE_OK;
+}
+
+// enqueue multiple values in queue (returns number of enqueued values)
+int enq_batch(const value_t *vs, int n, queue *q) {
+  int id = omp_get_thread_num();
+  node *first = NULL;
+  node *last = NULL;
+  int c = 0;
+  for (; c < n; c++) {
+    node *nd = node_new(q, id, NULL);
+    if (nd == NULL) { break; }  // buy more RAM
+    nd->value = vs[c];
+    node_link(nd, NULL);
+    if (last == NULL) { first = nd; } else { node_link(last, nd); }
+    last = nd;
+  }
+  if (c == 0) { return 0; }
+  shard_append(&q->shards[id], first, last);
+  count_enq(&q->count, id, c);
+  wait_wake(&q->waiting, c);
+  return c;
+}
+
+// enqueue multiple values in queue (including statistics)
+int enq_batch_stats(const value_t *vs, int n, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  node *first = NULL;
+  node *last = NULL;
+  int c = 0;
+  for (; c < n; c++) {
+    node *nd = node_new(q, id, s);
+    if (nd == NULL) { break; }  // buy more RAM
+    nd->value = vs[c];
+    node_link(nd, NULL);
+    if (last == NULL) { first = nd; } else { node_link(last, nd); }
+    last = nd;
+  }
+  if (c == 0) { return 0; }
+  shard_append(&q->shards[id], first, last);
+  count_enq(&q->count, id, c);
+  wait_wake_stats(&q->waiting, c, s);
+  return c;
+}
+
+// dequeue up to max values from queue (returns number of dequeued values)
+int deq_batch(value_t *vs, int max, queue *q) {
+  int id = omp_get_thread_num();
+  if (max <= 0) { return 0; }
+  node *first, *last;
+  int c = shard_take(&q->shards[id], vs, max, &first, &last, NULL);
+  if (c > 0) {
+    nodes_free(q, id, first, last, NULL);
+  } else {
+    c = steal(q, vs, max, id, NULL);
+  }
+  count_deq(&q->count, id, c);
+  return c;
+}
+
+// dequeue up to max values from queue (including statistics)
+int deq_batch_stats(value_t *vs, int max, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  if (max <= 0) { return 0; }
+  node *first, *last;
+  int c = shard_take(&q->shards[id], vs, max, &first, &last, s);
+  if (c > 0) {
+    nodes_free(q, id, first, last, s);
+  } else {
+    c = steal(q, vs, max, id, s);
+  }
+  count_deq(&q->count, id, c);
+  return c;
+}
+
+// dequeue from queue, sleep while it is empty (at most timeout seconds, forever if timeout < 0)
+int deq_wait(value_t *v, queue *q, double timeout) {
+  return wait_deq(&q->waiting, deq, v, q, timeout);
+}
+
+// dequeue from queue, sleep while it is empty (including statistics)
+int deq_wait_stats(value_t *v, queue *q, double timeout, stats *s) {
+  return wait_deq_stats(&q->waiting, deq_stats, v, q, timeout, s);
+}
+
+// length of queue (walk: sum over all sub-queues)
+int len(queue *q) {
+#if LEN == LEN_WALK
+  int c = 0;
+  for (int i = 0; i < q->max_threads; i++) {
+    node *n = get_node(sptr_load(&q->shards[i].head));
+    n = get_node(sptr_load(&n->snext));
+    while (n != NULL) {
+      c++;
+      n = get_node(sptr_load(&n->snext));
+    }
+  }
+  return c;
+#else
+  return count_len(&q->count);
+#endif
+}
+
+// destroy queue
+void destroy(queue *q) {
+  pool_destroy(&q->nodes);
+  slab_destroy(&q->arena);
+  free(q->shards);
+  count_destroy(&q->count);
+  free(q);
+}
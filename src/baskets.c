@@ -0,0 +1,415 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "queue.h"
+#include "slab.h"
+#include "pool.h"
+#include "stamp.h"
+#include "backoff.h"
+#include "wait.h"
+#include "count.h"
+#include <omp.h>
+
+#define CAS sptr_cas // weak (cmpxchg16b with DWCAS)
+
+// deleted nodes a dequeuer skips before it unlinks them
+#ifndef MAX_HOPS
+#define MAX_HOPS 3
+#endif
+
+// stamped node pointer (the lowest pointer bit marks the node it points to as deleted)
+typedef sptr snode_ptr;
+
+// node definition
+typedef struct node {
+  value_t value;
+  asptr snext;
+} node;
+
+// stamp node and mark it as deleted or not
+static snode_ptr mark(node *n, int deleted, stamp_t s) {
+  return stamp((void*)((uintptr_t)n | (uintptr_t)deleted), s);
+}
+
+// get node from stamped node
+static node *get_node(snode_ptr sn) {
+  return (node*)((uintptr_t)get_ptr(sn) & ~(uintptr_t)1);
+}
+
+// whether stamped node points to a deleted node
+static int is_deleted(snode_ptr sn) {
+  return (int)((uintptr_t)get_ptr(sn) & 1);
+}
+
+// link n to next within a private chain (the stamp keeps counting, a recycled node never gets the same snext again)
+static void chain_link(node *n, node *next) {
+  sptr_store(&n->snext, mark(next, 0, get_stamp(sptr_load(&n->snext)) + 1));
+}
+
+// queue definition (enqueuers that lose the same CAS on the tail share a basket instead of retrying)
+typedef struct queue {
+  PADDED asptr head;
+  PADDED asptr tail;
+  pool nodes;
+  slab arena;
+  backoff *backoffs;
+  waiter waiting;
+  counter count;
+  int max_threads;
+} queue;
+
+// get node from the pool, fall back to the slab
+static node *node_new(queue *q, int id) {
+  node *n = (node*)pool_get(&q->nodes, id);
+  if (n != NULL) { return n; }
+  return (node*)slab_alloc(&q->arena, id);
+}
+
+// get node from the pool, fall back to the slab (including statistics)
+static node *node_new_stats(queue *q, int id, stats *s) {
+  node *n = (node*)pool_get_stats(&q->nodes, id, s);
+  if (n != NULL) { return n; }
+  return (node*)slab_alloc_stats(&q->arena, id, s);
+}
+
+// create queue
+queue* create() {
+  queue *q = (queue*)calloc_padded(1, sizeof(queue));
+  if (!q) { return NULL; }  // buy more RAM
+  return q;
+}
+
+// initialize queue
+int init(queue *q) {
+  q->max_threads = omp_get_max_threads();
+  // nodes belong to the slab, the pool recycles them and hands back what it does not keep
+  int ret_pool = pool_init(&q->nodes, q->max_threads, &q->arena);
+  int ret_slab = slab_init(&q->arena, sizeof(node), q->max_threads);
+  q->backoffs = backoff_create(q->max_threads);
+  int ret_count = count_init(&q->count, q->max_threads);
+  if (ret_pool != QUEUE_OK || ret_slab != QUEUE_OK || q->backoffs == NULL || ret_count != QUEUE_OK) {
+    pool_destroy(&q->nodes);
+    slab_destroy(&q->arena);
+    free(q->backoffs);
+    count_destroy(&q->count);
+    return QUEUE_NOMEM;
+  }  // buy more RAM
+  node *n = node_new(q, omp_get_thread_num());
+  if (n == NULL) {
+    pool_destroy(&q->nodes);
+    slab_destroy(&q->arena);
+    free(q->backoffs);
+    count_destroy(&q->count);
+    return QUEUE_NOMEM;
+  }  // buy more RAM
+  sptr_store(&n->snext, mark(NULL, 0, 0));
+  sptr_store(&q->head, stamp(n, 0));
+  sptr_store(&q->tail, stamp(n, 0));
+  wait_init(&q->waiting);
+  return QUEUE_OK;
+}
+
+// move lagging tail to the last node
+static void fix_tail(queue *q, snode_ptr stail, node *next) {
+  while (sptr_load(&q->tail) == stail) {
+    node *n = get_node(sptr_load(&next->snext));
+    if (n == NULL) { break; }
+    next = n;
+  }
+  CAS(&q->tail, &stail, stamp(next, get_stamp(stail) + 1));
+}
+
+// move lagging tail to the last node (including statistics)
+static void fix_tail_stats(queue *q, snode_ptr stail, node *next, stats *s) {
+  while (sptr_load(&q->tail) == stail) {
+    node *n = get_node(sptr_load(&next->snext));
+    if (n == NULL) { break; }
+    next = n;
+  }
+  if (CAS(&q->tail, &stail, stamp(next, get_stamp(stail) + 1))) { s->cas_succ++; } else { s->cas_fail++; }
+}
+
+// link chain first..last behind the tail; after a lost CAS insert it into the basket of the winners
+static void link_chain(queue *q, int id, node *first, node *last) {
+  while(1) {
+    snode_ptr stail = sptr_load(&q->tail);
+    node *tail = get_node(stail);
+    snode_ptr snext = sptr_load(&tail->snext);
+    if (stail != sptr_load(&q->tail)) { continue; }
+
+    if (get_node(snext) == NULL) {
+      sptr_store(&last->snext, mark(NULL, 0, get_stamp(stail) + 2));
+      if (CAS(&tail->snext, &snext, mark(first, 0, get_stamp(stail) + 1))) {
+        backoff_succ(&q->backoffs[id]);
+        CAS(&q->tail, &stail, stamp(last, get_stamp(stail) + 1));
+        return;
+      }
+      // next got linked during this tail (same stamp) and is not dequeued yet: it is our basket
+      while (get_stamp(snext) == (stamp_t)(get_stamp(stail) + 1) && !is_deleted(snext)) {
+        backoff_fail(&q->backoffs[id]);
+        sptr_store(&last->snext, snext);
+        if (CAS(&tail->snext, &snext, mark(first, 0, get_stamp(stail) + 1))) {
+          backoff_succ(&q->backoffs[id]);
+          return;
+        }
+      }
+    } else {
+      fix_tail(q, stail, get_node(snext));
+    }
+  }
+}
+
+// link chain first..last behind the tail (including statistics)
+static void link_chain_stats(queue *q, int id, node *first, node *last, stats *s) {
+  while(1) {
+    snode_ptr stail = sptr_load(&q->tail);
+    node *tail = get_node(stail);
+    snode_ptr snext = sptr_load(&tail->snext);
+    if (stail != sptr_load(&q->tail)) { continue; }
+
+    if (get_node(snext) == NULL) {
+      sptr_store(&last->snext, mark(NULL, 0, get_stamp(stail) + 2));
+      if (CAS(&tail->snext, &snext, mark(first, 0, get_stamp(stail) + 1))) {
+        s->cas_succ++;
+        backoff_succ(&q->backoffs[id]);
+        if (CAS(&q->tail, &stail, stamp(last, get_stamp(stail) + 1))) { s->cas_succ++; } else { s->cas_fail++; }
+        return;
+      } else { s->cas_fail++; }
+      // next got linked during this tail (same stamp) and is not dequeued yet: it is our basket
+      while (get_stamp(snext) == (stamp_t)(get_stamp(stail) + 1) && !is_deleted(snext)) {
+        backoff_fail_stats(&q->backoffs[id], s);
+        sptr_store(&last->snext, snext);
+        if (CAS(&tail->snext, &snext, mark(first, 0, get_stamp(stail) + 1))) {
+          s->cas_succ++;
+          backoff_succ(&q->backoffs[id]);
+          return;
+        } else { s->cas_fail++; }
+      }
+    } else {
+      fix_tail_stats(q, stail, get_node(snext), s);
+    }
+  }
+}
+
+// unlink deleted nodes between head and new head, they go back to the pool
+static void free_chain(queue *q, int id, snode_ptr shead, node *new) {
+  if (!CAS(&q->head, &shead, stamp(new, get_stamp(shead) + 1))) { return; }
+  node *n = get_node(shead);
+  while (n != new) {
+    node *next = get_node(sptr_load(&n->snext));
+    pool_put(&q->nodes, id, n);
+    n = next;
+  }
+}
+
+// unlink deleted nodes between head and new head (including statistics)
+static void free_chain_stats(queue *q, int id, snode_ptr shead, node *new, stats *s) {
+  if (!CAS(&q->head, &shead, stamp(new, get_stamp(shead) + 1))) {
+    s->cas_fail++;
+    return;
+  }
+  s->cas_succ++;
+  node *n = get_node(shead);
+  while (n != new) {
+    node *next = get_node(sptr_load(&n->snext));
+    pool_put_stats(&q->nodes, id, n, s);
+    n = next;
+  }
+}
+
+// enqueue in queue
+int enq(value_t v, queue *q) {
+  int id = omp_get_thread_num();
+  node *n = node_new(q, id);
+  if (n == NULL) { return QUEUE_NOMEM; }  // buy more RAM
+  n->value = v;
+  link_chain(q, id, n, n);
+  count_enq(&q->count, id, 1);
+  wait_wake(&q->waiting, 1);
+  return QUEUE_OK;
+}
+
+// enqueue in queue (including statistics)
+int enq_stats(value_t v, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  node *n = node_new_stats(q, id, s);
+  if (n == NULL) { return QUEUE_NOMEM; }  // buy more RAM
+  n->value = v;
+  link_chain_stats(q, id, n, n, s);
+  count_enq(&q->count, id, 1);
+  wait_wake_stats(&q->waiting, 1, s);
+  return QUEUE_OK;
+}
+
+// dequeue from queue
+int deq(value_t *v, queue *q) {
+  int id = omp_get_thread_num();
+  while(1) {
+    snode_ptr shead = sptr_load(&q->head);
+    snode_ptr stail = sptr_load(&q->tail);
+    node *head = get_node(shead);
+    node *tail = get_node(stail);
+    snode_ptr snext = sptr_load(&head->snext);
+    if (shead != sptr_load(&q->head)) { continue; }
+
+    if (head == tail) {
+      if (get_node(snext) == NULL) { return QUEUE_EMPTY; }
+      fix_tail(q, stail, get_node(snext));
+      continue;
+    }
+    // skip nodes other dequeuers deleted already
+    node *iter = head;
+    int hops = 0;
+    while (is_deleted(snext) && iter != tail && sptr_load(&q->head) == shead) {
+      iter = get_node(snext);
+      snext = sptr_load(&iter->snext);
+      hops++;
+    }
+    if (sptr_load(&q->head) != shead) { continue; }
+    if (iter == tail) {
+      free_chain(q, id, shead, iter);
+      continue;
+    }
+    node *next = get_node(snext);
+    if (next == NULL) { continue; }  // iter got recycled in the meantime
+    *v = next->value;
+    if (CAS(&iter->snext, &snext, mark(next, 1, get_stamp(snext) + 1))) {
+      backoff_succ(&q->backoffs[id]);
+      if (hops >= MAX_HOPS) { free_chain(q, id, shead, next); }
+      count_deq(&q->count, id, 1);
+      return QUEUE_OK;
+    }
+    backoff_fail(&q->backoffs[id]);
+  }
+}
+
+// dequeue from queue (including statistics)
+int deq_stats(value_t *v, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  while(1) {
+    snode_ptr shead = sptr_load(&q->head);
+    snode_ptr stail = sptr_load(&q->tail);
+    node *head = get_node(shead);
+    node *tail = get_node(stail);
+    snode_ptr snext = sptr_load(&head->snext);
+    if (shead != sptr_load(&q->head)) { continue; }
+
+    if (head == tail) {
+      if (get_node(snext) == NULL) { return QUEUE_EMPTY; }
+      fix_tail_stats(q, stail, get_node(snext), s);
+      continue;
+    }
+    // skip nodes other dequeuers deleted already
+    node *iter = head;
+    int hops = 0;
+    while (is_deleted(snext) && iter != tail && sptr_load(&q->head) == shead) {
+      iter = get_node(snext);
+      snext = sptr_load(&iter->snext);
+      hops++;
+    }
+    if (sptr_load(&q->head) != shead) { continue; }
+    if (iter == tail) {
+      free_chain_stats(q, id, shead, iter, s);
+      continue;
+    }
+    node *next = get_node(snext);
+    if (next == NULL) { continue; }  // iter got recycled in the meantime
+    *v = next->value;
+    if (CAS(&iter->snext, &snext, mark(next, 1, get_stamp(snext) + 1))) {
+      s->cas_succ++;
+      backoff_succ(&q->backoffs[id]);
+      if (hops >= MAX_HOPS) { free_chain_stats(q, id, shead, next, s); }
+      count_deq(&q->count, id, 1);
+      return QUEUE_OK;
+    } else { s->cas_fail++; backoff_fail_stats(&q->backoffs[id], s); }
+  }
+}
+
+// enqueue multiple values in queue (returns number of enqueued values)
+int enq_batch(const value_t *vs, int n, queue *q) {
+  int id = omp_get_thread_num();
+  node *first = NULL;
+  node *last = NULL;
+  int c = 0;
+  for (; c < n; c++) {
+    node *nd = node_new(q, id);
+    if (nd == NULL) { break; }  // buy more RAM
+    nd->value = vs[c];
+    if (last == NULL) { first = nd; } else { chain_link(last, nd); }
+    last = nd;
+  }
+  if (c == 0) { return 0; }
+  link_chain(q, id, first, last);
+  count_enq(&q->count, id, c);
+  wait_wake(&q->waiting, c);
+  return c;
+}
+
+// enqueue multiple values in queue (including statistics)
+int enq_batch_stats(const value_t *vs, int n, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  node *first = NULL;
+  node *last = NULL;
+  int c = 0;
+  for (; c < n; c++) {
+    node *nd = node_new_stats(q, id, s);
+    if (nd == NULL) { break; }  // buy more RAM
+    nd->value = vs[c];
+    if (last == NULL) { first = nd; } else { chain_link(last, nd); }
+    last = nd;
+  }
+  if (c == 0) { return 0; }
+  link_chain_stats(q, id, first, last, s);
+  count_enq(&q->count, id, c);
+  wait_wake_stats(&q->waiting, c, s);
+  return c;
+}
+
+// dequeue up to max values from queue (returns number of dequeued values)
+int deq_batch(value_t *vs, int max, queue *q) {
+  int c = 0;
+  while (c < max && deq(&vs[c], q) == QUEUE_OK) { c++; }
+  return c;
+}
+
+// dequeue up to max values from queue (including statistics)
+int deq_batch_stats(value_t *vs, int max, queue *q, stats *s) {
+  int c = 0;
+  while (c < max && deq_stats(&vs[c], q, s) == QUEUE_OK) { c++; }
+  return c;
+}
+
+// dequeue from queue, sleep while it is empty (at most timeout seconds, forever if timeout < 0)
+int deq_wait(value_t *v, queue *q, double timeout) {
+  return wait_deq(&q->waiting, deq, v, q, timeout);
+}
+
+// dequeue from queue, sleep while it is empty (including statistics)
+int deq_wait_stats(value_t *v, queue *q, double timeout, stats *s) {
+  return wait_deq_stats(&q->waiting, deq_stats, v, q, timeout, s);
+}
+
+// length of queue (walk: nodes after the head that are not deleted)
+int len(queue *q) {
+#if LEN == LEN_WALK
+  node *n = get_node(sptr_load(&q->head));
+  int c = 0;
+  while (n != NULL) {
+    snode_ptr snext = sptr_load(&n->snext);
+    if (get_node(snext) != NULL && !is_deleted(snext)) { c++; }
+    n = get_node(snext);
+  }
+  return c;
+#else
+  return count_len(&q->count);
+#endif
+}
+
+// destroy queue
+void destroy(queue *q) {
+  pool_destroy(&q->nodes);
+  slab_destroy(&q->arena);
+  free(q->backoffs);
+  count_destroy(&q->count);
+  free(q);
+}
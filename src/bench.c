@@ -1,25 +1,212 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <string.h>
-#include <malloc.h>
+#include <time.h>
 #include "queue.h"
+#include "backoff.h"
+#include "place.h"
 #include <omp.h>
 
+#ifdef QUEUE_REGISTRY
+#include "registry.h"
+#else
+#ifndef QUEUE_ONLY
+#define QUEUE_ONLY queue
+#endif
+#ifndef QUEUE_ONLY_FLAGS
+#define QUEUE_ONLY_FLAGS 0
+#endif
+// the one variant this binary is linked with
+static const queue_ops registry[] = {
+  { QUEUE_STR(QUEUE_ONLY), QUEUE_ONLY_FLAGS, create, init, enq, enq_stats, deq, deq_stats,
+    enq_batch, enq_batch_stats, deq_batch, deq_batch_stats, deq_wait, deq_wait_stats, len, destroy },
+};
+#endif
+
+#define REGISTRY_SIZE ((int)(sizeof(registry) / sizeof(registry[0])))
+
+// cpu time consumed by the calling thread in nanoseconds
+static long thread_cpu_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (long)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// cpu of every thread (NULL: placement is left to the os, see place.h)
+static int *place_cpus = NULL;
+
+// pin the calling worker to its cpu (every time, the os threads behind omp may change between parallel regions)
+static void pin_self() {
+  if (place_cpus != NULL) {
+    place_pin(place_cpus[omp_get_thread_num()]);
+  }
+}
+
+// count events of the kernel around the worker loops (see perf.h)
+static int perf_on = 0;
+
+// time every lat_every-th enqueue and dequeue call of a thread into the latency histograms of its stats (0: none)
+static int lat_every = 0;
+
+// machine readable records (bench -j): a json object per line for every thread of every repetition
+static FILE *json_out = NULL;
+// fields of the run every record starts with (parameters, see json_params)
+static char *json_run = NULL;
+// repetition running at the moment
+static int json_rep = 0;
+
+// write a record for every thread of an experiment (Ebs/Dbs: per thread batch sizes, NULL if not fixed per thread)
+static void json_records(const queue_ops *o, stats *ss, int threads, const int *Ebs, const int *Dbs) {
+  if (json_out == NULL) { return; }
+  for (int i = 0; i < threads; i++) {
+    fprintf(json_out, "{%s, \"variant\": \"%s\", \"rep\": %d, \"thread\": %d", json_run, o->name, json_rep, i);
+    if (Ebs != NULL) {
+      fprintf(json_out, ", \"enq_batch\": %d, \"deq_batch\": %d", Ebs[i], Dbs[i]);
+    }
+    fprintf(json_out, ", \"cpu\": %d", place_cpus != NULL ? place_cpus[i] : -1);
+    json_stats(json_out, &ss[i]);
+    fprintf(json_out, "}\n");
+  }
+  fflush(json_out);
+}
+
+// whether the next call gets timed (tick counts the calls of one kind of a thread)
+static int lat_due(int *tick) {
+  if (lat_every == 0 || ++*tick < lat_every) { return 0; }
+  *tick = 0;
+  return 1;
+}
+
+// enqueue one value
+static int enq_one(const queue_ops *o, queue *q, value_t v, stats *s, int *tick) {
+  int timed = lat_due(tick);
+  long t = timed ? hist_now() : 0;
+  int ret = o->enq_stats(v, q, s);
+  if (timed) { hist_record(&s->enq_lat, hist_now() - t); }
+  return ret;
+}
+
+// dequeue one value (sleeps up to wait seconds on an empty queue if wait > 0)
+static int deq_one(const queue_ops *o, queue *q, value_t *v, double wait, stats *s, int *tick) {
+  int timed = lat_due(tick);
+  long t = timed ? hist_now() : 0;
+  int ret = wait > 0 ? o->deq_wait_stats(v, q, wait, s) : o->deq_stats(v, q, s);
+  if (timed) { hist_record(&s->deq_lat, hist_now() - t); }
+  return ret;
+}
+
+// enqueue a batch of values (a timed batch counts as one call)
+static int enq_batch_one(const queue_ops *o, queue *q, const value_t *vs, int n, stats *s, int *tick) {
+  int timed = lat_due(tick);
+  long t = timed ? hist_now() : 0;
+  int c = o->enq_batch_stats(vs, n, q, s);
+  if (timed) { hist_record(&s->enq_lat, hist_now() - t); }
+  return c;
+}
+
+// dequeue a batch of values (a timed batch counts as one call)
+static int deq_batch_one(const queue_ops *o, queue *q, value_t *vs, int max, stats *s, int *tick) {
+  int timed = lat_due(tick);
+  long t = timed ? hist_now() : 0;
+  int c = o->deq_batch_stats(vs, max, q, s);
+  if (timed) { hist_record(&s->deq_lat, hist_now() - t); }
+  return c;
+}
+
+// threaded worker with fixed number of enqueue and dequeue batches (using batch operations)
+void worker_fixed_batch(const queue_ops *o, queue *q, stats *s, int duration, int eb, int db) {
+  int size = eb > db ? eb : db;
+  value_t *vs = (value_t*)malloc(sizeof(value_t) * (size > 0 ? size : 1));
+  if (vs == NULL) { return; }  // buy more RAM
+  for (int i = 0; i < eb; i++) {
+    vs[i] = VALUE(i);
+  }
+  int enq_tick = 0;
+  int deq_tick = 0;
+  perf p;
+  perf_start(&p, perf_on);
+  long cpu = thread_cpu_ns();
+  double start = omp_get_wtime();
+  while (omp_get_wtime() - start < duration) {
+    if (eb > 0) {
+      int c = enq_batch_one(o, q, vs, eb, s, &enq_tick);
+      s->enq_succ += c;
+      s->enq_fail += eb - c;
+    }
+    if (db > 0) {
+      int c = deq_batch_one(o, q, vs, db, s, &deq_tick);
+      s->deq_succ += c;
+      s->deq_fail += db - c;
+    }
+  }
+  s->duration = omp_get_wtime() - start;
+  s->cpu_ns = thread_cpu_ns() - cpu;
+  perf_stop(&p, s->perf, &s->perf_mask);
+  free(vs);
+}
+
+// threaded worker with random number of enqueue and dequeue batches (using batch operations)
+void worker_rand_batch(const queue_ops *o, queue *q, stats *s, int duration, int eb_min, int eb_max, int db_min, int db_max) {
+  int size = eb_max > db_max ? eb_max : db_max;
+  value_t *vs = (value_t*)malloc(sizeof(value_t) * (size > 0 ? size : 1));
+  if (vs == NULL) { return; }  // buy more RAM
+  int enq_tick = 0;
+  int deq_tick = 0;
+  perf p;
+  perf_start(&p, perf_on);
+  long cpu = thread_cpu_ns();
+  double start = omp_get_wtime();
+  unsigned int seed = (unsigned int)(omp_get_thread_num() * 100000);
+  while (omp_get_wtime() - start < duration) {
+    int eb = eb_min + rand_r(&seed) % (eb_max - eb_min + 1);
+    for (int i = 0; i < eb; i++) {
+      vs[i] = VALUE(i);
+    }
+    if (eb > 0) {
+      int c = enq_batch_one(o, q, vs, eb, s, &enq_tick);
+      s->enq_succ += c;
+      s->enq_fail += eb - c;
+    }
+    int db = db_min + rand_r(&seed) % (db_max - db_min + 1);
+    if (db > 0) {
+      int c = deq_batch_one(o, q, vs, db, s, &deq_tick);
+      s->deq_succ += c;
+      s->deq_fail += db - c;
+    }
+  }
+  s->duration = omp_get_wtime() - start;
+  s->cpu_ns = thread_cpu_ns() - cpu;
+  perf_stop(&p, s->perf, &s->perf_mask);
+  free(vs);
+}
+
 // threaded worker with fixed number of enqueue and dequeue batches
-void worker_fixed(queue *q, stats *s, int duration, int eb, int db) {
+void worker_fixed(const queue_ops *o, queue *q, stats *s, int duration, int eb, int db, int batch, double wait) {
+  pin_self();
+  if (batch) {
+    worker_fixed_batch(o, q, s, duration, eb, db);
+    return;
+  }
+  int enq_tick = 0;
+  int deq_tick = 0;
+  perf p;
+  perf_start(&p, perf_on);
+  long cpu = thread_cpu_ns();
   double start = omp_get_wtime();
   value_t v;
   while (omp_get_wtime() - start < duration) {
     for (int i = 0; i < eb; i++) {
-      if (enq_stats((value_t)i, q, s) == QUEUE_OK) {
+      if (enq_one(o, q, VALUE(i), s, &enq_tick) == QUEUE_OK) {
         s->enq_succ++;
       } else {
         s->enq_fail++;
       }
     }
     for (int i = 0; i < db; i++) {
-      if (deq_stats(&v, q, s) == QUEUE_OK) {
+      if (deq_one(o, q, &v, wait, s, &deq_tick) == QUEUE_OK) {
         s->deq_succ++;
       } else {
         s->deq_fail++;
@@ -27,17 +214,29 @@ void worker_fixed(queue *q, stats *s, int duration, int eb, int db) {
     }
   }
   s->duration = omp_get_wtime() - start;
+  s->cpu_ns = thread_cpu_ns() - cpu;
+  perf_stop(&p, s->perf, &s->perf_mask);
 }
 
 // threaded worker with random number of enqueue and dequeue batches
-void worker_rand(queue *q, stats *s, int duration, int eb_min, int eb_max, int db_min, int db_max) {
+void worker_rand(const queue_ops *o, queue *q, stats *s, int duration, int eb_min, int eb_max, int db_min, int db_max, int batch, double wait) {
+  pin_self();
+  if (batch) {
+    worker_rand_batch(o, q, s, duration, eb_min, eb_max, db_min, db_max);
+    return;
+  }
+  int enq_tick = 0;
+  int deq_tick = 0;
+  perf p;
+  perf_start(&p, perf_on);
+  long cpu = thread_cpu_ns();
   double start = omp_get_wtime();
   unsigned int seed = (unsigned int)(omp_get_thread_num() * 100000);
   value_t v;
   while (omp_get_wtime() - start < duration) {
     int eb = eb_min + rand_r(&seed) % (eb_max - eb_min + 1);
     for (int i = 0; i < eb; i++) {
-      if (enq_stats((value_t)i, q, s) == QUEUE_OK) {
+      if (enq_one(o, q, VALUE(i), s, &enq_tick) == QUEUE_OK) {
         s->enq_succ++;
       } else {
         s->enq_fail++;
@@ -45,7 +244,7 @@ void worker_rand(queue *q, stats *s, int duration, int eb_min, int eb_max, int d
     }
     int db = db_min + rand_r(&seed) % (db_max - db_min + 1);
     for (int i = 0; i < db; i++) {
-      if (deq_stats(&v, q, s) == QUEUE_OK) {
+      if (deq_one(o, q, &v, wait, s, &deq_tick) == QUEUE_OK) {
         s->deq_succ++;
       } else {
         s->deq_fail++;
@@ -53,32 +252,35 @@ void worker_rand(queue *q, stats *s, int duration, int eb_min, int eb_max, int d
     }
   }
   s->duration = omp_get_wtime() - start;
+  s->cpu_ns = thread_cpu_ns() - cpu;
+  perf_stop(&p, s->perf, &s->perf_mask);
 }
 
 // run one (equal) experiment
-int experiment_equal(int threads, int duration, int eb_min, int eb_max, int db_min, int db_max) {
-  queue *q = create();
-  init(q);
+int experiment_equal(const queue_ops *o, int threads, int duration, int eb_min, int eb_max, int db_min, int db_max, int batch, double wait) {
+  queue *q = o->create();
+  o->init(q);
 
-  stats *ss = (stats*)calloc(threads, sizeof(stats));
+  stats *ss = (stats*)calloc_padded(threads, sizeof(stats));
   if (ss == NULL) {
     printf("ERROR: Unable to allocate s.... Buy more RAM\n");
-    destroy(q);
+    o->destroy(q);
     return 1;
   }
 
   if (eb_min == eb_max && db_min == db_max) {
     #pragma omp parallel num_threads(threads)
-    worker_fixed(q, &ss[omp_get_thread_num()], duration, eb_min, db_min);
+    worker_fixed(o, q, &ss[omp_get_thread_num()], duration, eb_min, db_min, batch, wait);
   } else {
     #pragma omp parallel num_threads(threads)
-    worker_rand(q, &ss[omp_get_thread_num()], duration, eb_min, eb_max, db_min, db_max);
+    worker_rand(o, q, &ss[omp_get_thread_num()], duration, eb_min, eb_max, db_min, db_max, batch, wait);
   }
 
   for (int i = 0; i < threads; i++) {
     printf("Thread: %d ", i);
     print_stats(&ss[i]);
   }
+  json_records(o, ss, threads, NULL, NULL);
 
   stats s = comb_stats(ss, threads);
   printf("\n");
@@ -86,33 +288,34 @@ int experiment_equal(int threads, int duration, int eb_min, int eb_max, int db_m
   print_stats(&s);
 
   free(ss);
-  destroy(q);
+  o->destroy(q);
 
   return 0;
 }
 
 // run one (unequal) experiment
-int experiment_unequal(int threads, int duration, int *Ebs, int *Dbs) {
-  queue *q = create();
-  init(q);
+int experiment_unequal(const queue_ops *o, int threads, int duration, int *Ebs, int *Dbs, int batch, double wait) {
+  queue *q = o->create();
+  o->init(q);
 
-  stats *ss = (stats*)calloc(threads, sizeof(stats));
+  stats *ss = (stats*)calloc_padded(threads, sizeof(stats));
   if (ss == NULL) {
     printf("ERROR: Unable to allocate s.... Buy more RAM\n");
-    destroy(q);
+    o->destroy(q);
     return 1;
   }
 
   #pragma omp parallel num_threads(threads)
   {
     int id = omp_get_thread_num();
-    worker_fixed(q, &ss[id], duration, Ebs[id], Dbs[id]);
+    worker_fixed(o, q, &ss[id], duration, Ebs[id], Dbs[id], batch, wait);
   }
 
   for (int i = 0; i < threads; i++) {
     printf("Thread: %d ", i);
     print_stats(&ss[i]);
   }
+  json_records(o, ss, threads, Ebs, Dbs);
 
   stats s = comb_stats(ss, threads);
   printf("\n");
@@ -120,15 +323,15 @@ int experiment_unequal(int threads, int duration, int *Ebs, int *Dbs) {
   print_stats(&s);
 
   free(ss);
-  destroy(q);
+  o->destroy(q);
 
   return 0;
 }
 
 // run correctneess check
-int check_correctness(int threads, int duration) {
-  queue *q = create();
-  init(q);
+int check_correctness(const queue_ops *o, int threads, int duration) {
+  queue *q = o->create();
+  o->init(q);
 
   int *enques = (int*)calloc(threads, sizeof(int));
   int *deques = (int*)calloc(threads, sizeof(int));
@@ -139,8 +342,9 @@ int check_correctness(int threads, int duration) {
     double start = omp_get_wtime();
     int i = 0;
     while (omp_get_wtime() - start < (duration * 0.5)) {
-      enq((value_t)(i * threads + id), q);
-      i++;
+      if (o->enq(VALUE(i * threads + id), q) == QUEUE_OK) {
+        i++;  // bounded variants may be full
+      }
     }
     enques[id] = i;
   }
@@ -149,8 +353,8 @@ int check_correctness(int threads, int duration) {
   {
     int *deques_local = (int*)calloc(threads, sizeof(int));
     value_t v;
-    while (deq(&v, q) != QUEUE_EMPTY) {
-      deques_local[(int)v % threads]++;
+    while (o->deq(&v, q) != QUEUE_EMPTY) {
+      deques_local[KEY(v) % threads]++;
     }
 
     #pragma omp critical
@@ -188,20 +392,176 @@ int check_correctness(int threads, int duration) {
 
   free(enques);
   free(deques);
-  destroy(q);
+  o->destroy(q);
 
   return correct;
 }
 
+// select variants by comma separated names (all if names is NULL), returns number of selected variants or -1
+int select_queues(char *names, int threads, const queue_ops **sel) {
+  int n = 0;
+  for (char *token = names ? strtok(names, ",") : NULL; token; token = strtok(NULL, ",")) {
+    int i = 0;
+    while (i < REGISTRY_SIZE && strcmp(token, registry[i].name) != 0) { i++; }
+    if (i == REGISTRY_SIZE) {
+      printf("ERROR: unknown queue '%s'\n", token);
+      return -1;
+    }
+    int j = 0;
+    while (j < n && sel[j] != &registry[i]) { j++; }
+    if (j == n) { sel[n++] = &registry[i]; }
+  }
+  if (names == NULL) {
+    for (int i = 0; i < REGISTRY_SIZE; i++) {
+      sel[n++] = &registry[i];
+    }
+  }
+  // sequential variants can not be shared between threads
+  int m = 0;
+  for (int i = 0; i < n; i++) {
+    if (!(sel[i]->flags & QUEUE_SEQUENTIAL) || threads == 1) {
+      sel[m++] = sel[i];
+    }
+  }
+  return m;
+}
+
+// batch sizes of thread pattern p (same patterns as run_nebula_conc.sh)
+// a: every thread enqueues and dequeues, b: thread 0 enqueues, the others dequeue,
+// c: the first half enqueues, the second half dequeues, d: even threads enqueue, odd ones dequeue,
+// e: thread 0 dequeues, the others enqueue
+void pattern_batches(char p, int threads, int eb, int db, int *Ebs, int *Dbs) {
+  for (int i = 0; i < threads; i++) {
+    int e;
+    switch(p) {
+      case 'b': e = i == 0; break;
+      case 'c': e = i < threads / 2; break;
+      case 'd': e = i % 2 == 0; break;
+      case 'e': e = i != 0; break;
+      default:  e = 1;
+    }
+    Ebs[i] = e ? eb : 0;
+    Dbs[i] = !e || p == 'a' ? db : 0;
+  }
+}
+
+// pattern the per thread batch sizes follow (0 if none), so -E/-D runs get recorded with their pattern as well
+char pattern_of(int threads, const int *Ebs, const int *Dbs) {
+  int eb = 0;
+  int db = 0;
+  for (int i = 0; i < threads; i++) {
+    eb = Ebs[i] > eb ? Ebs[i] : eb;
+    db = Dbs[i] > db ? Dbs[i] : db;
+  }
+  int *E = (int*)malloc(threads * sizeof(int));
+  int *D = (int*)malloc(threads * sizeof(int));
+  char found = 0;
+  for (const char *p = "abcde"; E != NULL && D != NULL && *p != '\0' && found == 0; p++) {
+    pattern_batches(*p, threads, eb, db, E, D);
+    if (memcmp(E, Ebs, threads * sizeof(int)) == 0 && memcmp(D, Dbs, threads * sizeof(int)) == 0) {
+      found = *p;
+    }
+  }
+  free(E);
+  free(D);
+  return found;
+}
+
+// drop single producer/consumer variants if more than one thread enqueues/dequeues, returns number of kept variants
+int filter_queues(const queue_ops **sel, int n, int enqueuers, int dequeuers) {
+  int m = 0;
+  for (int i = 0; i < n; i++) {
+    if ((sel[i]->flags & QUEUE_SP) && enqueuers > 1) {
+      printf("INFO: Skipping %s (one enqueuing thread at most, got %d)\n", sel[i]->name, enqueuers);
+      continue;
+    }
+    if ((sel[i]->flags & QUEUE_SC) && dequeuers > 1) {
+      printf("INFO: Skipping %s (one dequeuing thread at most, got %d)\n", sel[i]->name, dequeuers);
+      continue;
+    }
+    sel[m++] = sel[i];
+  }
+  if (m == 0) {
+    printf("ERROR: no queue left to run\n");
+  }
+  return m;
+}
+
+// json string contents of s (quotes, backslashes and control characters escaped), NULL if out of memory
+static char *json_escape(const char *s) {
+  char *e = (char*)malloc(strlen(s) * 6 + 1);
+  if (e == NULL) { return NULL; }  // buy more RAM
+  char *d = e;
+  for (; *s != '\0'; s++) {
+    unsigned char c = (unsigned char)*s;
+    if (c == '"' || c == '\\') {
+      *d++ = '\\';
+      *d++ = (char)c;
+    } else if (c < 0x20) {
+      d += sprintf(d, "\\u%04x", c);
+    } else {
+      *d++ = (char)c;
+    }
+  }
+  *d = '\0';
+  return e;
+}
+
+// formatted string sized to fit (NULL if out of memory or on an encoding error, never truncated)
+static char *json_format(const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+  if (n < 0) { return NULL; }
+  char *s = (char*)malloc(n + 1);
+  if (s == NULL) { return NULL; }  // buy more RAM
+  va_start(ap, fmt);
+  int m = vsnprintf(s, n + 1, fmt, ap);
+  va_end(ap);
+  if (m != n) {
+    free(s);
+    return NULL;
+  }
+  return s;
+}
+
+// fill json_run with the parameters of a run (host, pid and start time tell runs apart), returns 0 on success
+int json_params(int threads, int duration, int repetition, char pattern, int eb_min, int eb_max, int db_min, int db_max,
+                int batch, int wait_us, const char *placement) {
+  char name[256] = "unknown";
+  gethostname(name, sizeof(name) - 1);
+  char p[2] = { pattern, '\0' };
+#ifdef NO_PAD
+  int padded = 0;
+#else
+  int padded = 1;
+#endif
+  char *host = json_escape(name);
+  char *place = json_escape(placement);
+  if (host != NULL && place != NULL) {
+    json_run = json_format(
+        "\"run\": \"%s-%d-%ld\", \"host\": \"%s\", \"threads\": %d, \"time\": %d, \"repetitions\": %d, "
+        "\"pattern\": \"%s\", \"enq_batch_min\": %d, \"enq_batch_max\": %d, \"deq_batch_min\": %d, \"deq_batch_max\": %d, "
+        "\"batch\": %d, \"payload\": %d, \"unroll\": %d, \"padded\": %d, \"backoff\": \"%s\", \"backoff_min\": %d, "
+        "\"backoff_max\": %d, \"wait_us\": %d, \"lat_every\": %d, \"perf\": %d, \"placement\": \"%s\"",
+        host, (int)getpid(), (long)time(NULL), host, threads, duration, repetition,
+        p, eb_min, eb_max, db_min, db_max,
+        batch, PAYLOAD, UNROLL, padded, backoff_names[backoff_conf.policy], backoff_conf.min,
+        backoff_conf.max, wait_us, lat_every, perf_on, place);
+  }
+  free(host);
+  free(place);
+  return json_run == NULL;
+}
+
 // start the experiment with user provided parameters
 int main(int argc, char** argv) {
-  // decrease malloc arena count; otherwise nebula cannot do s... as RAM goes brrrrrr for > 50 threads
-  mallopt(M_ARENA_MAX, 1);
-
   int threads = omp_get_max_threads();
   int duration = 1;
   int repetition = 1;
   int correctness = 0;
+  int batch = 0;
   int help = 0;
   int eb_flag = 0;
   int eb_min = 10;
@@ -209,16 +569,23 @@ int main(int argc, char** argv) {
   int db_flag = 0;
   int db_min = 10;
   int db_max = 10;
+  int wait_us = 0;
+  char pattern = 0;
+  int placement = PLACE_NONE;
+  char *place_list = NULL;
   char *Eb = NULL;
   char *Db = NULL;
+  char *Q = NULL;
+  char *json_file = NULL;
 
   int opt;
-  while((opt = getopt(argc, argv, "n:t:r:ce:d:E:D:h")) != -1) {
+  while((opt = getopt(argc, argv, "n:t:r:cbe:d:E:D:P:p:q:B:w:l:Hj:h")) != -1) {
     switch(opt) {
       case 'n': threads = atoi(optarg); break;
       case 't': duration = atoi(optarg); break;
       case 'r': repetition = atoi(optarg); break;
       case 'c': correctness = 1; break;
+      case 'b': batch = 1; break;
       case 'h': help = 1; break;
       case 'e': {
         eb_flag = 1;
@@ -242,6 +609,26 @@ int main(int argc, char** argv) {
       }
       case 'E': Eb = strdup(optarg); break;
       case 'D': Db = strdup(optarg); break;
+      case 'P': pattern = optarg[0]; break;
+      case 'p':
+        placement = place_parse(optarg);
+        place_list = optarg;
+        if (placement < 0) {
+          printf("ERROR: unknown placement '%s'\n", optarg);
+          help = 1;
+        }
+        break;
+      case 'q': Q = optarg; break;
+      case 'B':
+        if (backoff_parse(optarg) != 0) {
+          printf("ERROR: unknown backoff '%s'\n", optarg);
+          help = 1;
+        }
+        break;
+      case 'w': wait_us = atoi(optarg); break;
+      case 'l': lat_every = atoi(optarg); break;
+      case 'H': perf_on = 1; break;
+      case 'j': json_file = optarg; break;
       default: help = 1;
     }
   }
@@ -253,6 +640,29 @@ int main(int argc, char** argv) {
     printf("ERROR: if -E or -D flag is set, -e or -d flag can not be set.\n");
     help = 1;
   }
+  if (pattern != 0) {
+    if (strchr("abcde", pattern) == NULL) {
+      printf("ERROR: unknown pattern '%c'\n", pattern);
+      help = 1;
+    } else if (Eb != NULL) {
+      printf("ERROR: -P flag can not be used with -E and -D flag.\n");
+      help = 1;
+    } else if (eb_min != eb_max || db_min != db_max) {
+      printf("ERROR: -P flag needs fixed batch sizes (-e <i> -d <i>).\n");
+      help = 1;
+    }
+  }
+  if (lat_every < 0) {
+    printf("ERROR: latency sampling (%d) < 0\n", lat_every);
+    help = 1;
+  }
+  if (wait_us < 0) {
+    printf("ERROR: wait (%d) < 0\n", wait_us);
+    help = 1;
+  } else if (wait_us > 0 && batch == 1) {
+    printf("ERROR: -w flag can not be used with -b flag.\n");
+    help = 1;
+  }
   if (Eb == NULL) {
     if (eb_min > eb_max) {
       printf("ERROR: eb_min (%d) > eb_max(%d)\n", eb_min, eb_max);
@@ -264,6 +674,13 @@ int main(int argc, char** argv) {
     }
   }
 
+  const queue_ops *queues[REGISTRY_SIZE];
+  int nq = 0;
+  if (help == 0) {
+    nq = select_queues(Q, threads, queues);
+    if (nq < 0) { help = 1; }
+  }
+
   if (help == 1) {
     printf("Usage: \n");
     printf("%s:\n", argv[0]);
@@ -271,28 +688,64 @@ int main(int argc, char** argv) {
     printf(" -t <i>: duration in seconds\n");
     printf(" -r <i>: number of repetitions\n");
     printf(" -c: check for correctness\n");
+    printf(" -b: use batch enqueue/dequeue operations\n");
     printf(" -h: display this help menu\n");
     printf(" -e <i>/<i>,<i>: enqueue batch size (size or min,max)\n");
     printf(" -d <i>/<i>,<i>: dequeue batch size (size or min,max)\n");
     printf(" -E <i>,...: enqueue batch size (per thread)\n");
     printf(" -D <i>,...: dequeue batch size (per thread)\n");
+    printf(" -p <s>: pin threads (none, compact: fill socket by socket, scatter: round robin over sockets, smt: smt siblings first, or a cpu list like 0,2,8-11)\n");
+    printf(" -P <c>: thread pattern with -e/-d batch sizes (a: all enqueue and dequeue, b: thread 0 enqueues, c: first half enqueues, d: even threads enqueue, e: thread 0 dequeues)\n");
+    printf(" -q <s>,...: queues to run, interleaved per repetition, sequential ones only with -n 1, single producer/consumer ones only with one enqueuing/dequeuing thread (default: all of");
+    for (int i = 0; i < REGISTRY_SIZE; i++) {
+      printf(" %s", registry[i].name);
+    }
+    printf(")\n");
+    printf(" -B <s>/<s>,<i>,<i>: backoff of cas after a failed CAS (none, exp, trunc, rand, adaptive; optional min,max spins)\n");
+    printf(" -w <i>: dequeue with deq_wait, sleeping up to <i> microseconds on an empty queue (0: plain deq)\n");
+    printf(" -l <i>: time every <i>-th enqueue/dequeue call of a thread, print latency percentiles (0: none)\n");
+    printf(" -H: count cycles, instructions, cache misses (software events if unavailable) per thread with perf_event_open\n");
+    printf(" -j <s>: append a json record per thread and repetition (all parameters and statistics) to file <s>\n");
     return 0;
   }
 
+  // queues size their per thread state by omp_get_max_threads() in init
+  omp_set_num_threads(threads);
+
+  if (placement != PLACE_NONE) {
+    place_cpus = (int*)malloc(threads * sizeof(int));
+    if (place_cpus == NULL) {
+      printf("ERROR: Unable to allocate s.... Buy more RAM\n");
+      return 1;
+    }
+    if (place_plan(placement, place_list, place_cpus, threads) != 0) {
+      printf("ERROR: no cpus to place threads on\n");
+      free(place_cpus);
+      return 1;
+    }
+  }
+
   printf("INFO: Threads:     %d\n", threads);
   printf("INFO: Duration:    %d\n", duration);
 
   if (correctness == 1) {
     printf("INFO: Checking for correctness. Ignoring all flags except -n and -t\n");
+    nq = filter_queues(queues, nq, threads, threads);
+    if (nq == 0) { return 1; }
     printf("\n");
-    return check_correctness(threads, duration);
+    int correct = 0;
+    for (int i = 0; i < nq; i++) {
+      printf("Queue: %s\n", queues[i]->name);
+      correct |= check_correctness(queues[i], threads, duration);
+    }
+    return correct;
   }
 
   printf("INFO: Repetitions: %d\n", repetition);
 
   int *Ebs = NULL;
   int *Dbs = NULL;
-  if (Eb != NULL) {
+  if (Eb != NULL || pattern != 0) {
     Ebs = (int*)malloc(threads * sizeof(int));
     Dbs = (int*)malloc(threads * sizeof(int));
     if (Ebs == NULL || Dbs == NULL) {
@@ -302,30 +755,34 @@ int main(int argc, char** argv) {
       return 1;
     }
 
-    int count = 0;
-    char *token = strtok(Eb, ",");
-    while (token && count < threads) {
-      Ebs[count++] = atoi(token);
-      token = strtok(NULL, ",");
-    }
-    if (count != threads || token != NULL) {
-      printf("ERROR: expected exactly %d (= -n) values for -E\n", threads);
-      free(Ebs);
-      free(Dbs);
-      return 1;
-    }
+    if (pattern != 0) {
+      pattern_batches(pattern, threads, eb_min, db_min, Ebs, Dbs);
+    } else {
+      int count = 0;
+      char *token = strtok(Eb, ",");
+      while (token && count < threads) {
+        Ebs[count++] = atoi(token);
+        token = strtok(NULL, ",");
+      }
+      if (count != threads || token != NULL) {
+        printf("ERROR: expected exactly %d (= -n) values for -E\n", threads);
+        free(Ebs);
+        free(Dbs);
+        return 1;
+      }
 
-    count = 0;
-    token = strtok(Db, ",");
-    while (token && count < threads) {
-      Dbs[count++] = atoi(token);
-      token = strtok(NULL, ",");
-    }
-    if (count != threads || token != NULL) {
-      printf("ERROR: expected exactly %d (= -n) values for -D\n", threads);
-      free(Ebs);
-      free(Dbs);
-      return 1;
+      count = 0;
+      token = strtok(Db, ",");
+      while (token && count < threads) {
+        Dbs[count++] = atoi(token);
+        token = strtok(NULL, ",");
+      }
+      if (count != threads || token != NULL) {
+        printf("ERROR: expected exactly %d (= -n) values for -D\n", threads);
+        free(Ebs);
+        free(Dbs);
+        return 1;
+      }
     }
 
     printf("INFO: Enque batches: [");
@@ -339,6 +796,9 @@ int main(int argc, char** argv) {
       printf("%d ", Dbs[i]);
     }
     printf("]\n");
+    if (pattern != 0) {
+      printf("INFO: Pattern:     %c\n", pattern);
+    }
 
   } else {
     if (eb_min != eb_max) {
@@ -353,20 +813,116 @@ int main(int argc, char** argv) {
     }
   }
 
+  int enqueuers = 0;
+  int dequeuers = 0;
+  for (int i = 0; i < threads; i++) {
+    enqueuers += (Ebs != NULL ? Ebs[i] : eb_max) > 0;
+    dequeuers += (Dbs != NULL ? Dbs[i] : db_max) > 0;
+  }
+  nq = filter_queues(queues, nq, enqueuers, dequeuers);
+  if (nq == 0) {
+    free(Ebs);
+    free(Dbs);
+    return 1;
+  }
+
+  if (batch == 1) {
+    printf("INFO: Using batch operations\n");
+  }
+  printf("INFO: Payload:     %d bytes\n", PAYLOAD);
+  printf("INFO: Backoff:     %s (%d, %d)\n", backoff_names[backoff_conf.policy], backoff_conf.min, backoff_conf.max);
+  if (wait_us > 0) {
+    printf("INFO: Waiting:     %d us\n", wait_us);
+  }
+  if (lat_every > 0) {
+    printf("INFO: Latency:     every %d calls\n", lat_every);
+  }
+  if (perf_on) {
+    printf("INFO: Perf:        on\n");
+  }
+  if (place_cpus != NULL) {
+    // pin once up front to show where threads actually end up
+    int *got = (int*)calloc(threads, sizeof(int));
+    if (got != NULL) {
+      #pragma omp parallel num_threads(threads)
+      {
+        int id = omp_get_thread_num();
+        got[id] = place_pin(place_cpus[id]) == 0 ? sched_getcpu() : -1;
+      }
+    }
+    printf("INFO: Placement:   %s\n", place_names[placement]);
+    for (int i = 0; i < threads; i++) {
+      int cpu = got != NULL ? got[i] : -1;
+      if (cpu < 0) {
+        printf("INFO: Thread %d -> cpu %d: pinning failed\n", i, place_cpus[i]);
+      } else {
+        printf("INFO: Thread %d -> cpu %d (node %d, socket %d, core %d)\n", i, cpu,
+               place_node(cpu), place_read(cpu, "topology/physical_package_id"), place_read(cpu, "topology/core_id"));
+      }
+    }
+    free(got);
+  }
+  printf("INFO: Queues:     ");
+  for (int i = 0; i < nq; i++) {
+    printf(" %s", queues[i]->name);
+  }
+  printf("\n");
+  if (json_file != NULL) {
+    json_out = fopen(json_file, "a");
+    if (json_out == NULL) {
+      printf("ERROR: unable to open '%s'\n", json_file);
+      free(Ebs);
+      free(Dbs);
+      free(place_cpus);
+      return 1;
+    }
+    printf("INFO: Records:     %s\n", json_file);
+    int eb_lo = eb_min, eb_hi = eb_max, db_lo = db_min, db_hi = db_max;
+    if (Ebs != NULL) {
+      eb_lo = db_lo = 1 << 30;
+      eb_hi = db_hi = 0;
+      for (int i = 0; i < threads; i++) {
+        eb_lo = Ebs[i] < eb_lo ? Ebs[i] : eb_lo;
+        eb_hi = Ebs[i] > eb_hi ? Ebs[i] : eb_hi;
+        db_lo = Dbs[i] < db_lo ? Dbs[i] : db_lo;
+        db_hi = Dbs[i] > db_hi ? Dbs[i] : db_hi;
+      }
+    }
+    char pat = Ebs != NULL ? pattern_of(threads, Ebs, Dbs) : 0;
+    if (json_params(threads, duration, repetition, pat, eb_lo, eb_hi, db_lo, db_hi, batch, wait_us,
+                    placement == PLACE_LIST ? place_list : place_names[placement]) != 0) {
+      printf("ERROR: Unable to allocate s.... Buy more RAM\n");
+      fclose(json_out);
+      free(Ebs);
+      free(Dbs);
+      free(place_cpus);
+      return 1;
+    }
+  }
+
+  double wait = wait_us * 1e-6;
   int ret_code = 0;
   printf("\n");
-  for (int r = 0; r < repetition; r++) {
-    if (Eb != NULL) {
-      ret_code = experiment_unequal(threads, duration, Ebs, Dbs);
-    } else {
-      ret_code = experiment_equal(threads, duration, eb_min, eb_max, db_min, db_max);
+  // variants take turns within every repetition, so drift hits all of them alike
+  for (int r = 0; r < repetition && ret_code == 0; r++) {
+    json_rep = r;
+    for (int i = 0; i < nq; i++) {
+      printf("Queue: %s\n", queues[i]->name);
+      if (Ebs != NULL) {
+        ret_code = experiment_unequal(queues[i], threads, duration, Ebs, Dbs, batch, wait);
+      } else {
+        ret_code = experiment_equal(queues[i], threads, duration, eb_min, eb_max, db_min, db_max, batch, wait);
+      }
+      if (ret_code != 0) { break; }
+      printf("\n\n");
     }
-    if (ret_code != 0) { break; }
-    printf("\n\n");
   }
 
   free(Ebs);
   free(Dbs);
+  free(place_cpus);
+  if (json_out != NULL) { fclose(json_out); }
+  free(json_run);
   return ret_code;
 }
 
@@ -2,48 +2,90 @@
 #include <stdint.h>
 #include <stdatomic.h>
 #include "queue.h"
+#include "slab.h"
+#include "pool.h"
+#include "smr.h"
+#include "stamp.h"
+#include "backoff.h"
+#include "wait.h"
+#include "count.h"
 #include <omp.h>
 
-#define CAS atomic_compare_exchange_weak // weak|strong
+#define CAS sptr_cas // weak (cmpxchg16b with DWCAS)
 
 // stamped node pointer
-typedef uint64_t snode_ptr;
-
-// stamp
-typedef uint16_t stamp_t;
+typedef sptr snode_ptr;
 
 // node definition
 typedef struct node {
   value_t value;
-  _Atomic(snode_ptr) snext;
+  asptr snext;
 } node;
 
-// stamp node
-static snode_ptr stamp(node *n, stamp_t stamp) {
-  return ((snode_ptr)stamp << 48) | ((snode_ptr)n & 0x0000FFFFFFFFFFFF);
-}
-
-// get stamp from stamped node
-static stamp_t get_stamp(snode_ptr sn) {
-  return (stamp_t)(sn >> 48);
-}
-
 // get node from stamped node
 static node *get_node(snode_ptr sn) {
-  return (node*)(sn & 0x0000FFFFFFFFFFFF);
+  return (node*)get_ptr(sn);
+}
+
+// point node to next (the stamp keeps counting, so a stale CAS on a recycled node fails)
+static void node_link(node *n, node *next) {
+  sptr_store(&n->snext, stamp(next, get_stamp(sptr_load(&n->snext)) + 1));
 }
 
 // queue definition
 typedef struct queue {
-  _Atomic(snode_ptr) head;
-  _Atomic(snode_ptr) tail;
-  _Atomic(snode_ptr) *freelists;
+  PADDED asptr head;
+  PADDED asptr tail;
+  pool nodes;
+  slab arena;
+  smr reclaim;
+  backoff *backoffs;
+  waiter waiting;
+  counter count;
   int max_threads;
 } queue;
 
+// read stamped pointer and protect the node it points to (hazard pointer i of thread)
+static snode_ptr protect(queue *q, asptr *src, int id, int i) {
+  snode_ptr sn = sptr_load(src);
+#ifdef SMR_HP
+  while(1) {
+    smr_hazard(&q->reclaim, id, i, get_node(sn));
+    snode_ptr check = sptr_load(src);
+    if (check == sn) { return sn; }
+    sn = check;
+  }
+#endif
+  return sn;
+}
+
+// get node from the pool, fall back to the slab (to the heap if nodes get reclaimed)
+static node *node_new(queue *q, int id) {
+  node *n = (node*)pool_get(&q->nodes, id);
+  if (n != NULL) { return n; }
+#ifdef SMR_ENABLED
+  return (node*)malloc(sizeof(node));
+#else
+  return (node*)slab_alloc(&q->arena, id);
+#endif
+}
+
+// get node from the pool, fall back to the slab (including statistics)
+static node *node_new_stats(queue *q, int id, stats *s) {
+  node *n = (node*)pool_get_stats(&q->nodes, id, s);
+  if (n != NULL) { return n; }
+#ifdef SMR_ENABLED
+  n = (node*)malloc(sizeof(node));
+  if (n != NULL) { s->node_alloc++; }
+  return n;
+#else
+  return (node*)slab_alloc_stats(&q->arena, id, s);
+#endif
+}
+
 // create queue
 queue* create() {
-  queue *q = (queue*)malloc(sizeof(queue));
+  queue *q = (queue*)calloc_padded(1, sizeof(queue));
   if (!q) { return NULL; }  // buy more RAM
   return q;
 }
@@ -51,47 +93,66 @@ queue* create() {
 // initialize queue
 int init(queue *q) {
   q->max_threads = omp_get_max_threads();
-  q->freelists = (_Atomic(snode_ptr)*)malloc(sizeof(_Atomic(snode_ptr)) * q->max_threads);
-  if (q->freelists == NULL) { return QUEUE_NOMEM; }  // buy more RAM
-  for (int i = 0; i < q->max_threads; i++) {
-    atomic_store(&q->freelists[i], stamp(NULL, 0));
-  }
-  node *n = (node*)malloc(sizeof(node));
+#ifdef SMR_ENABLED
+  // nodes come from the heap, reclaimed ones go back to it once the pool is full
+  int ret_pool = pool_init(&q->nodes, q->max_threads, NULL);
+#else
+  // nodes belong to the slab, the pool recycles them and hands back what it does not keep
+  int ret_pool = pool_init(&q->nodes, q->max_threads, &q->arena);
+#endif
+  int ret_slab = slab_init(&q->arena, sizeof(node), q->max_threads);
+  int ret_smr = smr_init(&q->reclaim, &q->nodes, q->max_threads);
+  q->backoffs = backoff_create(q->max_threads);
+  int ret_count = count_init(&q->count, q->max_threads);
+  if (ret_pool != QUEUE_OK || ret_slab != QUEUE_OK || ret_smr != QUEUE_OK || q->backoffs == NULL || ret_count != QUEUE_OK) {
+    pool_destroy(&q->nodes);
+    slab_destroy(&q->arena);
+    smr_destroy(&q->reclaim);
+    free(q->backoffs);
+    count_destroy(&q->count);
+    return QUEUE_NOMEM;
+  }  // buy more RAM
+  node *n = node_new(q, omp_get_thread_num());
   if (n == NULL) {
-    destroy(q);
+    pool_destroy(&q->nodes);
+    slab_destroy(&q->arena);
+    smr_destroy(&q->reclaim);
+    free(q->backoffs);
+    count_destroy(&q->count);
     return QUEUE_NOMEM;
   }  // buy more RAM
-  atomic_store(&n->snext, stamp(NULL, 0));
-  atomic_store(&q->head, stamp(n, 0));
-  atomic_store(&q->tail, stamp(n, 0));
+  node_link(n, NULL);
+  sptr_store(&q->head, stamp(n, 0));
+  sptr_store(&q->tail, stamp(n, 0));
+  wait_init(&q->waiting);
   return QUEUE_OK;
 }
 
 // enqueue in queue
 int enq(value_t v, queue *q) {
   int id = omp_get_thread_num();
-  snode_ptr sn = atomic_load(&q->freelists[id]);
-  node *n = get_node(sn);
-  if (n == NULL) {
-    n = (node*)malloc(sizeof(node));
-    if (n == NULL) { return QUEUE_NOMEM; }  // buy more RAM
-  } else {
-    atomic_store(&q->freelists[id], atomic_load(&n->snext));
-  }
+  node *n = node_new(q, id);
+  if (n == NULL) { return QUEUE_NOMEM; }  // buy more RAM
   n->value = v;
-  atomic_store(&n->snext, stamp(NULL, 0));
+  node_link(n, NULL);
 
+  smr_enter(&q->reclaim, id);
   while(1) {
-    snode_ptr stail = atomic_load(&q->tail);
+    snode_ptr stail = protect(q, &q->tail, id, 0);
     node *tail = get_node(stail);
-    snode_ptr snext = atomic_load(&tail->snext);
+    snode_ptr snext = sptr_load(&tail->snext);
     node *next = get_node(snext);
 
     if (next == NULL) {
       if (CAS(&tail->snext, &snext, stamp(n, get_stamp(snext) + 1))) {
+        backoff_succ(&q->backoffs[id]);
         CAS(&q->tail, &stail, stamp(n, get_stamp(stail) + 1));
+        smr_exit(&q->reclaim, id);
+        count_enq(&q->count, id, 1);
+        wait_wake(&q->waiting, 1);
         return QUEUE_OK;
       }
+      backoff_fail(&q->backoffs[id]);
     } else {
       CAS(&q->tail, &stail, stamp(next, get_stamp(stail) + 1));
     }
@@ -101,30 +162,28 @@ int enq(value_t v, queue *q) {
 // enqueue in queue (including statistics)
 int enq_stats(value_t v, queue *q, stats *s) {
   int id = omp_get_thread_num();
-  snode_ptr sn = atomic_load(&q->freelists[id]);
-  node *n = get_node(sn);
-  if (n == NULL) {
-    n = (node*)malloc(sizeof(node));
-    if (n == NULL) { return QUEUE_NOMEM; }  // buy more RAM
-  } else {
-    s->freelist_len--;
-    atomic_store(&q->freelists[id], atomic_load(&n->snext));
-  }
+  node *n = node_new_stats(q, id, s);
+  if (n == NULL) { return QUEUE_NOMEM; }  // buy more RAM
   n->value = v;
-  atomic_store(&n->snext, stamp(NULL, 0));
+  node_link(n, NULL);
 
+  smr_enter(&q->reclaim, id);
   while(1) {
-    snode_ptr stail = atomic_load(&q->tail);
+    snode_ptr stail = protect(q, &q->tail, id, 0);
     node *tail = get_node(stail);
-    snode_ptr snext = atomic_load(&tail->snext);
+    snode_ptr snext = sptr_load(&tail->snext);
     node *next = get_node(snext);
 
     if (next == NULL) {
       if (CAS(&tail->snext, &snext, stamp(n, get_stamp(snext) + 1))) {
         s->cas_succ++;
+        backoff_succ(&q->backoffs[id]);
         if (CAS(&q->tail, &stail, stamp(n, get_stamp(stail) + 1))) { s->cas_succ++; } else { s->cas_fail++; }
+        smr_exit(&q->reclaim, id);
+        count_enq(&q->count, id, 1);
+        wait_wake_stats(&q->waiting, 1, s);
         return QUEUE_OK;
-      } else { s->cas_fail++; }
+      } else { s->cas_fail++; backoff_fail_stats(&q->backoffs[id], s); }
     } else {
       if (CAS(&q->tail, &stail, stamp(next, get_stamp(stail) + 1))) { s->cas_succ++; } else { s->cas_fail++; }
     }
@@ -134,24 +193,32 @@ int enq_stats(value_t v, queue *q, stats *s) {
 // dequeue from queue
 int deq(value_t *v, queue *q) {
   int id = omp_get_thread_num();
+  smr_enter(&q->reclaim, id);
   while(1) {
-    snode_ptr shead = atomic_load(&q->head);
+    snode_ptr shead = protect(q, &q->head, id, 0);
     node *head = get_node(shead);
-    snode_ptr stail = atomic_load(&q->tail);
+    snode_ptr stail = sptr_load(&q->tail);
     node *tail = get_node(stail);
-    snode_ptr snext = atomic_load(&head->snext);
+    snode_ptr snext = sptr_load(&head->snext);
     node *next = get_node(snext);
-    if (shead != atomic_load(&q->head) || stail != atomic_load(&q->tail)) { continue; }
+    smr_hazard(&q->reclaim, id, 1, next);
+    if (shead != sptr_load(&q->head) || stail != sptr_load(&q->tail)) { continue; }
     if (head == tail) {
-      if (next == NULL) { return QUEUE_EMPTY; }
+      if (next == NULL) {
+        smr_exit(&q->reclaim, id);
+        return QUEUE_EMPTY;
+      }
       CAS(&q->tail, &stail, stamp(next, get_stamp(stail) + 1));
     } else if (next != NULL) {
       *v = next->value;
       if (CAS(&q->head, &shead, stamp(next, get_stamp(shead) + 1))) {
-        atomic_store(&head->snext, atomic_load(&q->freelists[id]));
-        atomic_store(&q->freelists[id], stamp(head, get_stamp(shead) + 1));
+        backoff_succ(&q->backoffs[id]);
+        smr_exit(&q->reclaim, id);
+        smr_retire(&q->reclaim, id, head);
+        count_deq(&q->count, id, 1);
         return QUEUE_OK;
       }
+      backoff_fail(&q->backoffs[id]);
     }
   }
 }
@@ -159,64 +226,259 @@ int deq(value_t *v, queue *q) {
 // dequeue in queue (including statistics)
 int deq_stats(value_t *v, queue *q, stats *s) {
   int id = omp_get_thread_num();
+  smr_enter(&q->reclaim, id);
   while(1) {
-    snode_ptr shead = atomic_load(&q->head);
+    snode_ptr shead = protect(q, &q->head, id, 0);
     node *head = get_node(shead);
-    snode_ptr stail = atomic_load(&q->tail);
+    snode_ptr stail = sptr_load(&q->tail);
     node *tail = get_node(stail);
-    snode_ptr snext = atomic_load(&head->snext);
+    snode_ptr snext = sptr_load(&head->snext);
     node *next = get_node(snext);
-    if (shead != atomic_load(&q->head) || stail != atomic_load(&q->tail)) { continue; }
+    smr_hazard(&q->reclaim, id, 1, next);
+    if (shead != sptr_load(&q->head) || stail != sptr_load(&q->tail)) { continue; }
     if (head == tail) {
-      if (next == NULL) { return QUEUE_EMPTY; }
+      if (next == NULL) {
+        smr_exit(&q->reclaim, id);
+        return QUEUE_EMPTY;
+      }
       if (CAS(&q->tail, &stail, stamp(next, get_stamp(stail) + 1))) { s->cas_succ++; } else { s->cas_fail++; }
     } else if (next != NULL) {
       *v = next->value;
       if (CAS(&q->head, &shead, stamp(next, get_stamp(shead) + 1))) {
         s->cas_succ++;
-        atomic_store(&head->snext, atomic_load(&q->freelists[id]));
-        atomic_store(&q->freelists[id], stamp(head, get_stamp(shead) + 1));
-        s->freelist_len++;
-        if (s->freelist_len > s->freelist_max) {
-          s->freelist_max = s->freelist_len;
-        }
-        s->freelist_insert++;
+        backoff_succ(&q->backoffs[id]);
+        smr_exit(&q->reclaim, id);
+        smr_retire_stats(&q->reclaim, id, head, s);
+        count_deq(&q->count, id, 1);
         return QUEUE_OK;
-      } else { s->cas_fail++; }
+      } else { s->cas_fail++; backoff_fail_stats(&q->backoffs[id], s); }
+    }
+  }
+}
+
+// enqueue multiple values in queue (returns number of enqueued values)
+int enq_batch(const value_t *vs, int n, queue *q) {
+  int id = omp_get_thread_num();
+  node *first = NULL;
+  node *last = NULL;
+  int c = 0;
+  for (; c < n; c++) {
+    node *nd = node_new(q, id);
+    if (nd == NULL) { break; }  // buy more RAM
+    nd->value = vs[c];
+    node_link(nd, NULL);
+    if (last == NULL) { first = nd; } else { node_link(last, nd); }
+    last = nd;
+  }
+  if (c == 0) { return 0; }
+
+  smr_enter(&q->reclaim, id);
+  while(1) {
+    snode_ptr stail = protect(q, &q->tail, id, 0);
+    node *tail = get_node(stail);
+    snode_ptr snext = sptr_load(&tail->snext);
+    node *next = get_node(snext);
+
+    if (next == NULL) {
+      if (CAS(&tail->snext, &snext, stamp(first, get_stamp(snext) + 1))) {
+        backoff_succ(&q->backoffs[id]);
+        CAS(&q->tail, &stail, stamp(last, get_stamp(stail) + 1));
+        smr_exit(&q->reclaim, id);
+        count_enq(&q->count, id, c);
+        wait_wake(&q->waiting, c);
+        return c;
+      }
+      backoff_fail(&q->backoffs[id]);
+    } else {
+      CAS(&q->tail, &stail, stamp(next, get_stamp(stail) + 1));
+    }
+  }
+}
+
+// enqueue multiple values in queue (including statistics)
+int enq_batch_stats(const value_t *vs, int n, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  node *first = NULL;
+  node *last = NULL;
+  int c = 0;
+  for (; c < n; c++) {
+    node *nd = node_new_stats(q, id, s);
+    if (nd == NULL) { break; }  // buy more RAM
+    nd->value = vs[c];
+    node_link(nd, NULL);
+    if (last == NULL) { first = nd; } else { node_link(last, nd); }
+    last = nd;
+  }
+  if (c == 0) { return 0; }
+
+  smr_enter(&q->reclaim, id);
+  while(1) {
+    snode_ptr stail = protect(q, &q->tail, id, 0);
+    node *tail = get_node(stail);
+    snode_ptr snext = sptr_load(&tail->snext);
+    node *next = get_node(snext);
+
+    if (next == NULL) {
+      if (CAS(&tail->snext, &snext, stamp(first, get_stamp(snext) + 1))) {
+        s->cas_succ++;
+        backoff_succ(&q->backoffs[id]);
+        if (CAS(&q->tail, &stail, stamp(last, get_stamp(stail) + 1))) { s->cas_succ++; } else { s->cas_fail++; }
+        smr_exit(&q->reclaim, id);
+        count_enq(&q->count, id, c);
+        wait_wake_stats(&q->waiting, c, s);
+        return c;
+      } else { s->cas_fail++; backoff_fail_stats(&q->backoffs[id], s); }
+    } else {
+      if (CAS(&q->tail, &stail, stamp(next, get_stamp(stail) + 1))) { s->cas_succ++; } else { s->cas_fail++; }
+    }
+  }
+}
+
+// dequeue up to max values from queue (returns number of dequeued values)
+int deq_batch(value_t *vs, int max, queue *q) {
+  int id = omp_get_thread_num();
+  if (max <= 0) { return 0; }
+  smr_enter(&q->reclaim, id);
+  while(1) {
+    snode_ptr shead = protect(q, &q->head, id, 0);
+    node *head = get_node(shead);
+    snode_ptr stail = sptr_load(&q->tail);
+    node *tail = get_node(stail);
+    snode_ptr snext = sptr_load(&head->snext);
+    node *next = get_node(snext);
+    smr_hazard(&q->reclaim, id, 1, next);
+    if (shead != sptr_load(&q->head) || stail != sptr_load(&q->tail)) { continue; }
+    if (head == tail) {
+      if (next == NULL) {
+        smr_exit(&q->reclaim, id);
+        return 0;
+      }
+      CAS(&q->tail, &stail, stamp(next, get_stamp(stail) + 1));
+    } else if (next != NULL) {
+      // collect values up to the tail, the head stamp tells whether they are still ours
+      node *new = next;
+      int c = 0;
+      vs[c++] = new->value;
+      while (c < max && new != tail) {
+        node *n = get_node(sptr_load(&new->snext));
+        if (n == NULL) { break; }
+#ifdef SMR_HP
+        // n may only be read as long as nothing got dequeued in the meantime (the CAS below fails then anyway)
+        smr_hazard(&q->reclaim, id, 1, n);
+        if (sptr_load(&q->head) != shead) { break; }
+#endif
+        new = n;
+        vs[c++] = new->value;
+      }
+      if (CAS(&q->head, &shead, stamp(new, get_stamp(shead) + 1))) {
+        backoff_succ(&q->backoffs[id]);
+        smr_exit(&q->reclaim, id);
+        while (head != new) {
+          node *n = get_node(sptr_load(&head->snext));
+          smr_retire(&q->reclaim, id, head);
+          head = n;
+        }
+        count_deq(&q->count, id, c);
+        return c;
+      }
+      backoff_fail(&q->backoffs[id]);
+    }
+  }
+}
+
+// dequeue up to max values from queue (including statistics)
+int deq_batch_stats(value_t *vs, int max, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  if (max <= 0) { return 0; }
+  smr_enter(&q->reclaim, id);
+  while(1) {
+    snode_ptr shead = protect(q, &q->head, id, 0);
+    node *head = get_node(shead);
+    snode_ptr stail = sptr_load(&q->tail);
+    node *tail = get_node(stail);
+    snode_ptr snext = sptr_load(&head->snext);
+    node *next = get_node(snext);
+    smr_hazard(&q->reclaim, id, 1, next);
+    if (shead != sptr_load(&q->head) || stail != sptr_load(&q->tail)) { continue; }
+    if (head == tail) {
+      if (next == NULL) {
+        smr_exit(&q->reclaim, id);
+        return 0;
+      }
+      if (CAS(&q->tail, &stail, stamp(next, get_stamp(stail) + 1))) { s->cas_succ++; } else { s->cas_fail++; }
+    } else if (next != NULL) {
+      // collect values up to the tail, the head stamp tells whether they are still ours
+      node *new = next;
+      int c = 0;
+      vs[c++] = new->value;
+      while (c < max && new != tail) {
+        node *n = get_node(sptr_load(&new->snext));
+        if (n == NULL) { break; }
+#ifdef SMR_HP
+        // n may only be read as long as nothing got dequeued in the meantime (the CAS below fails then anyway)
+        smr_hazard(&q->reclaim, id, 1, n);
+        if (sptr_load(&q->head) != shead) { break; }
+#endif
+        new = n;
+        vs[c++] = new->value;
+      }
+      if (CAS(&q->head, &shead, stamp(new, get_stamp(shead) + 1))) {
+        s->cas_succ++;
+        backoff_succ(&q->backoffs[id]);
+        smr_exit(&q->reclaim, id);
+        while (head != new) {
+          node *n = get_node(sptr_load(&head->snext));
+          smr_retire_stats(&q->reclaim, id, head, s);
+          head = n;
+        }
+        count_deq(&q->count, id, c);
+        return c;
+      } else { s->cas_fail++; backoff_fail_stats(&q->backoffs[id], s); }
     }
   }
 }
 
+// dequeue from queue, sleep while it is empty (at most timeout seconds, forever if timeout < 0)
+int deq_wait(value_t *v, queue *q, double timeout) {
+  return wait_deq(&q->waiting, deq, v, q, timeout);
+}
+
+// dequeue from queue, sleep while it is empty (including statistics)
+int deq_wait_stats(value_t *v, queue *q, double timeout, stats *s) {
+  return wait_deq_stats(&q->waiting, deq_stats, v, q, timeout, s);
+}
+
 // length of queue
 int len(queue *q) {
-  node *n = get_node(atomic_load(&q->head));
-  n = get_node(atomic_load(&n->snext));
+#if LEN == LEN_WALK
+  node *n = get_node(sptr_load(&q->head));
+  n = get_node(sptr_load(&n->snext));
   int c = 0;
   while (n != NULL) {
     c++;
-    n = get_node(atomic_load(&n->snext));
+    n = get_node(sptr_load(&n->snext));
   }
   return c;
+#else
+  return count_len(&q->count);
+#endif
 }
 
 // destroy queue
 void destroy(queue *q) {
-  node *n = get_node(atomic_load(&q->head));
+#ifdef SMR_ENABLED
+  node *n = get_node(sptr_load(&q->head));
   while (n != NULL) {
-    node *next = get_node(atomic_load(&n->snext));
+    node *next = get_node(sptr_load(&n->snext));
     free(n);
     n = next;
   }
-
-  for (int i = 0; i < q->max_threads; i++) {
-    n = get_node(atomic_load(&q->freelists[i]));
-    while (n != NULL) {
-      node *next = get_node(atomic_load(&n->snext));
-      free(n);
-      n = next;
-    }
-  }
-  free(q->freelists);
+#endif
+  smr_destroy(&q->reclaim);
+  pool_destroy(&q->nodes);
+  slab_destroy(&q->arena);
+  free(q->backoffs);
+  count_destroy(&q->count);
   free(q);
 }
 
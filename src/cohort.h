@@ -0,0 +1,96 @@
+#ifndef COHORT_H
+#define COHORT_H
+
+#include <stdatomic.h>
+#include "queue.h"
+#include "lock.h"
+
+// cohort lock (Dice, Marathe, Shavit): a lock per numa node in front of a global lock.
+// the holder of a local lock hands the global lock on to the next waiter of its node instead of releasing it,
+// so the lock and the data it guards stay in the caches of one socket for up to COHORT_BATCH handoffs.
+// both are test and test and set locks with backoff (C-BO-BO): the global lock gets released by another thread
+// than the one that took it, and unlike FIFO locks they do not hand off to a preempted waiter on a busy box
+
+// local handoffs before the global lock goes to another node
+#ifndef COHORT_BATCH
+#define COHORT_BATCH 64
+#endif
+
+// local lock of a node (owned and passes are only touched by the holder of the local lock)
+typedef struct cohort_local {
+  PADDED _Atomic(int) held;
+  _Atomic(int) waiting;  // threads of the node that want the lock
+  int owned;             // the node holds the global lock
+  int passes;            // handoffs within the node since it took the global lock
+} cohort_local;
+
+// cohort lock definition
+typedef struct cohort {
+  PADDED _Atomic(int) held;
+  cohort_local *locals;
+  int nodes;
+} cohort;
+
+// initialize cohort lock for nodes numa nodes
+static int cohort_init(cohort *c, int nodes) {
+  c->nodes = nodes;
+  atomic_store(&c->held, 0);
+  c->locals = (cohort_local*)calloc_padded(nodes, sizeof(cohort_local));
+  if (c->locals == NULL) { return QUEUE_NOMEM; }  // buy more RAM
+  return QUEUE_OK;
+}
+
+// take test and test and set lock, truncated exponential backoff after a lost race (same bounds as LOCK_TAS)
+static void cohort_take(_Atomic(int) *held) {
+  int w = LOCK_BACKOFF_MIN;
+  while (1) {
+    while (atomic_load(held)) {
+      backoff_spin(1);
+    }
+    if (atomic_exchange(held, 1) == 0) { return; }
+    backoff_spin(w);
+    w = w * 2 < LOCK_BACKOFF_MAX ? w * 2 : LOCK_BACKOFF_MAX;
+  }
+}
+
+// acquire cohort lock from numa node, returns 1 if the global lock came with it from the node
+static int cohort_acquire(cohort *c, int node) {
+  cohort_local *l = &c->locals[node];
+  atomic_fetch_add(&l->waiting, 1);
+  cohort_take(&l->held);
+  atomic_fetch_sub(&l->waiting, 1);
+  if (l->owned) { return 1; }
+  cohort_take(&c->held);
+  l->owned = 1;
+  l->passes = 0;
+  return 0;
+}
+
+// acquire cohort lock (including statistics)
+static void cohort_acquire_stats(cohort *c, int node, stats *s) {
+  if (cohort_acquire(c, node)) {
+    s->cohort_local++;
+  } else {
+    s->cohort_global++;
+  }
+}
+
+// release cohort lock of numa node (same as on acquire)
+static void cohort_release(cohort *c, int node) {
+  cohort_local *l = &c->locals[node];
+  // keep the global lock for a waiter of the same node unless the batch is used up
+  if (atomic_load(&l->waiting) > 0 && l->passes < COHORT_BATCH) {
+    l->passes++;
+  } else {
+    l->owned = 0;
+    atomic_store(&c->held, 0);
+  }
+  atomic_store(&l->held, 0);
+}
+
+// destroy cohort lock
+static void cohort_destroy(cohort *c) {
+  free(c->locals);
+}
+
+#endif
@@ -1,25 +1,51 @@
 #include <stdlib.h>
 #include "queue.h"
+#include "slab.h"
+#include "pool.h"
+#include "wait.h"
+#include "lock.h"
+#include "count.h"
 #include <omp.h>
 
-// node definition
+// node definition (unrolled, values[read..write) are still in the queue)
 typedef struct node {
-  value_t value;
+  int read;
+  int write;
   struct node *next;
+  value_t values[UNROLL];
 } node;
 
+// per thread spare node (fetched outside the lock, linked in once the tail node is full)
+typedef struct spare {
+  PADDED node *n;
+} spare;
+
 // queue definition
 typedef struct queue {
-  node *head;
-  node *tail;
-  node **freelists;
+  PADDED node *head;
+  PADDED node *tail;
+  lock lock;
+  pool nodes;
+  slab arena;
+  spare *spares;
+  waiter waiting;
+  counter count;
+  long size;  // LEN_EXACT only, guarded by lock
   int max_threads;
-  omp_lock_t lock;
 } queue;
 
+// n values went in (n > 0) or out (n < 0) of the queue, called under the lock
+static void size_add(queue *q, int id, long n) {
+#if LEN == LEN_EXACT
+  q->size += n;
+#else
+  if (n > 0) { count_enq(&q->count, id, n); } else { count_deq(&q->count, id, -n); }
+#endif
+}
+
 // create queue
 queue* create() {
-  queue *q = (queue*)malloc(sizeof(queue));
+  queue *q = (queue*)calloc_padded(1, sizeof(queue));
   if (!q) { return NULL; }  // buy more RAM
   return q;
 }
@@ -27,143 +53,352 @@ queue* create() {
 // initialize queue
 int init(queue *q) {
   q->max_threads = omp_get_max_threads();
-  q->freelists = (node**)calloc(q->max_threads, sizeof(node*));
-  if (q->freelists == NULL) { return QUEUE_NOMEM; }  // buy more RAM
-  node *n = (node*)malloc(sizeof(node));
+  // nodes belong to the slab, the pool recycles them and hands back what it does not keep
+  int ret_pool = pool_init(&q->nodes, q->max_threads, &q->arena);
+  int ret_slab = slab_init(&q->arena, sizeof(node), q->max_threads);
+  q->spares = (spare*)calloc_padded(q->max_threads, sizeof(spare));
+  int ret_lock = lock_init(&q->lock, q->max_threads);
+  int ret_count = count_init(&q->count, q->max_threads);
+  if (ret_pool != QUEUE_OK || ret_slab != QUEUE_OK || q->spares == NULL || ret_lock != QUEUE_OK || ret_count != QUEUE_OK) {
+    pool_destroy(&q->nodes);
+    slab_destroy(&q->arena);
+    free(q->spares);
+    lock_destroy(&q->lock);
+    count_destroy(&q->count);
+    return QUEUE_NOMEM;
+  }  // buy more RAM
+  node *n = (node*)slab_alloc(&q->arena, omp_get_thread_num());
   if (n == NULL) {
-    free(q->freelists);
+    pool_destroy(&q->nodes);
+    slab_destroy(&q->arena);
+    free(q->spares);
+    lock_destroy(&q->lock);
+    count_destroy(&q->count);
     return QUEUE_NOMEM;
   }  // buy more RAM
+  n->read = 0;
+  n->write = 0;
   n->next = NULL;
   q->head = n;
   q->tail = n;
-  omp_init_lock(&q->lock);
+  q->size = 0;
+  wait_init(&q->waiting);
   return QUEUE_OK;
 }
 
+// get empty node from pool or slab (NULL if out of memory)
+static node *node_get(queue *q, int id) {
+  node *n = (node*)pool_get(&q->nodes, id);
+  if (n == NULL) {
+    n = (node*)slab_alloc(&q->arena, id);
+    if (n == NULL) { return NULL; }  // buy more RAM
+  }
+  n->read = 0;
+  n->write = 0;
+  n->next = NULL;
+  return n;
+}
+
+// get empty node from pool or slab (including statistics)
+static node *node_get_stats(queue *q, int id, stats *s) {
+  node *n = (node*)pool_get_stats(&q->nodes, id, s);
+  if (n == NULL) {
+    n = (node*)slab_alloc_stats(&q->arena, id, s);
+    if (n == NULL) { return NULL; }  // buy more RAM
+  }
+  n->read = 0;
+  n->write = 0;
+  n->next = NULL;
+  return n;
+}
+
 // enqueue in queue
 int enq(value_t v, queue *q) {
-  omp_set_lock(&q->lock);
   int id = omp_get_thread_num();
-  node *n;
-  if (q->freelists[id] == NULL) {
-    n = (node*)malloc(sizeof(node));
-    if (n == NULL) {  // buy more RAM
-      omp_unset_lock(&q->lock);
-      return QUEUE_NOMEM;
-    }
+  node *n = q->spares[id].n;
+  if (n == NULL) {
+    n = node_get(q, id);
+    q->spares[id].n = n;
+  }
+  lock_acquire(&q->lock, id);
+  node *t = q->tail;
+  int w = t->write;
+  if (w < UNROLL) {
+    t->values[w] = v;
+    t->write = w + 1;
+  } else if (n != NULL) {
+    n->values[0] = v;
+    n->write = 1;
+    t->next = n;
+    q->tail = n;
+    q->spares[id].n = NULL;
   } else {
-    n = q->freelists[id];
-    q->freelists[id] = n->next;
+    lock_release(&q->lock, id);
+    return QUEUE_NOMEM;  // buy more RAM
   }
-  n->next = NULL;
-  n->value = v;
-  q->tail->next = n;
-  q->tail = n;
-  omp_unset_lock(&q->lock);
+  size_add(q, id, 1);
+  lock_release(&q->lock, id);
+  wait_wake(&q->waiting, 1);
   return QUEUE_OK;
 }
 
 // enqueue in queue (including statistics)
 int enq_stats(value_t v, queue *q, stats *s) {
-  omp_set_lock(&q->lock);
   int id = omp_get_thread_num();
-  node *n;
-  if (q->freelists[id] == NULL) {
-    n = (node*)malloc(sizeof(node));
-    if (n == NULL) {  // buy more RAM
-      omp_unset_lock(&q->lock);
-      return QUEUE_NOMEM;
-    }
+  node *n = q->spares[id].n;
+  if (n == NULL) {
+    n = node_get_stats(q, id, s);
+    q->spares[id].n = n;
+  }
+  lock_acquire(&q->lock, id);
+  node *t = q->tail;
+  int w = t->write;
+  if (w < UNROLL) {
+    t->values[w] = v;
+    t->write = w + 1;
+  } else if (n != NULL) {
+    n->values[0] = v;
+    n->write = 1;
+    t->next = n;
+    q->tail = n;
+    q->spares[id].n = NULL;
   } else {
-    n = q->freelists[id];
-    q->freelists[id] = n->next;
-    s->freelist_len--;
+    lock_release(&q->lock, id);
+    return QUEUE_NOMEM;  // buy more RAM
   }
-  n->next = NULL;
-  n->value = v;
-  q->tail->next = n;
-  q->tail = n;
-  omp_unset_lock(&q->lock);
+  size_add(q, id, 1);
+  lock_release(&q->lock, id);
+  wait_wake_stats(&q->waiting, 1, s);
   return QUEUE_OK;
 }
 
 // dequeue from queue
 int deq(value_t *v, queue *q) {
-  omp_set_lock(&q->lock);
   int id = omp_get_thread_num();
-  node *old;
-  node *new;
-  old = q->head;
-  new = old->next;
-  if (new == NULL) {
-    omp_unset_lock(&q->lock);
-    return QUEUE_EMPTY;
-  }
-  *v = new->value;
-  q->head = new;
-  old->next = q->freelists[id];
-  q->freelists[id] = old;
-  omp_unset_lock(&q->lock);
+  lock_acquire(&q->lock, id);
+  node *old = q->head;
+  node *h = old;
+  if (h->read == h->write) {
+    node *new = h->next;
+    if (new == NULL) {
+      lock_release(&q->lock, id);
+      return QUEUE_EMPTY;
+    }
+    h = new;
+    q->head = h;
+  }
+  *v = h->values[h->read++];
+  size_add(q, id, -1);
+  lock_release(&q->lock, id);
+  if (h != old) { pool_put(&q->nodes, id, old); }
   return QUEUE_OK;
 }
 
 // dequeue from queue (including statistics)
 int deq_stats(value_t *v, queue *q, stats *s) {
-  omp_set_lock(&q->lock);
   int id = omp_get_thread_num();
-  node *old;
-  node *new;
-  old = q->head;
-  new = old->next;
-  if (new == NULL) {
-    omp_unset_lock(&q->lock);
-    return QUEUE_EMPTY;
-  }
-  *v = new->value;
-  q->head = new;
-  old->next = q->freelists[id];
-  q->freelists[id] = old;
-  s->freelist_len++;
-  if (s->freelist_len > s->freelist_max) {
-    s->freelist_max = s->freelist_len;
-  }
-  s->freelist_insert++;
-  omp_unset_lock(&q->lock);
+  lock_acquire(&q->lock, id);
+  node *old = q->head;
+  node *h = old;
+  if (h->read == h->write) {
+    node *new = h->next;
+    if (new == NULL) {
+      lock_release(&q->lock, id);
+      return QUEUE_EMPTY;
+    }
+    h = new;
+    q->head = h;
+  }
+  *v = h->values[h->read++];
+  size_add(q, id, -1);
+  lock_release(&q->lock, id);
+  if (h != old) { pool_put_stats(&q->nodes, id, old, s); }
   return QUEUE_OK;
 }
 
+// enqueue multiple values in queue (returns number of enqueued values)
+int enq_batch(const value_t *vs, int n, queue *q) {
+  if (n <= 0) { return 0; }
+  int id = omp_get_thread_num();
+  // reserve enough nodes outside the lock, unused ones go back to the pool
+  node *rest = NULL;
+  for (int k = 0; k < (n + UNROLL - 1) / UNROLL; k++) {
+    node *nd = node_get(q, id);
+    if (nd == NULL) { break; }  // buy more RAM
+    nd->next = rest;
+    rest = nd;
+  }
+  lock_acquire(&q->lock, id);
+  node *t = q->tail;
+  int w = t->write;
+  int c = 0;
+  while (c < n && w < UNROLL) {
+    t->values[w++] = vs[c++];
+  }
+  t->write = w;
+  while (c < n && rest != NULL) {
+    node *nd = rest;
+    rest = nd->next;
+    nd->next = NULL;
+    for (w = 0; c < n && w < UNROLL; w++) {
+      nd->values[w] = vs[c++];
+    }
+    nd->write = w;
+    t->next = nd;
+    t = nd;
+  }
+  q->tail = t;
+  size_add(q, id, c);
+  lock_release(&q->lock, id);
+  while (rest != NULL) {
+    node *next = rest->next;
+    pool_put(&q->nodes, id, rest);
+    rest = next;
+  }
+  wait_wake(&q->waiting, c);
+  return c;
+}
+
+// enqueue multiple values in queue (including statistics)
+int enq_batch_stats(const value_t *vs, int n, queue *q, stats *s) {
+  if (n <= 0) { return 0; }
+  int id = omp_get_thread_num();
+  // reserve enough nodes outside the lock, unused ones go back to the pool
+  node *rest = NULL;
+  for (int k = 0; k < (n + UNROLL - 1) / UNROLL; k++) {
+    node *nd = node_get_stats(q, id, s);
+    if (nd == NULL) { break; }  // buy more RAM
+    nd->next = rest;
+    rest = nd;
+  }
+  lock_acquire(&q->lock, id);
+  node *t = q->tail;
+  int w = t->write;
+  int c = 0;
+  while (c < n && w < UNROLL) {
+    t->values[w++] = vs[c++];
+  }
+  t->write = w;
+  while (c < n && rest != NULL) {
+    node *nd = rest;
+    rest = nd->next;
+    nd->next = NULL;
+    for (w = 0; c < n && w < UNROLL; w++) {
+      nd->values[w] = vs[c++];
+    }
+    nd->write = w;
+    t->next = nd;
+    t = nd;
+  }
+  q->tail = t;
+  size_add(q, id, c);
+  lock_release(&q->lock, id);
+  while (rest != NULL) {
+    node *next = rest->next;
+    pool_put_stats(&q->nodes, id, rest, s);
+    rest = next;
+  }
+  wait_wake_stats(&q->waiting, c, s);
+  return c;
+}
+
+// dequeue up to max values from queue (returns number of dequeued values)
+int deq_batch(value_t *vs, int max, queue *q) {
+  int id = omp_get_thread_num();
+  lock_acquire(&q->lock, id);
+  node *old = q->head;
+  node *h = old;
+  int c = 0;
+  while (c < max) {
+    int w = h->write;
+    if (h->read == w) {
+      node *new = h->next;
+      if (new == NULL) { break; }
+      h = new;
+      continue;
+    }
+    while (c < max && h->read < w) {
+      vs[c++] = h->values[h->read++];
+    }
+  }
+  q->head = h;
+  size_add(q, id, -c);
+  lock_release(&q->lock, id);
+  while (old != h) {
+    node *next = old->next;
+    pool_put(&q->nodes, id, old);
+    old = next;
+  }
+  return c;
+}
+
+// dequeue up to max values from queue (including statistics)
+int deq_batch_stats(value_t *vs, int max, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  lock_acquire(&q->lock, id);
+  node *old = q->head;
+  node *h = old;
+  int c = 0;
+  while (c < max) {
+    int w = h->write;
+    if (h->read == w) {
+      node *new = h->next;
+      if (new == NULL) { break; }
+      h = new;
+      continue;
+    }
+    while (c < max && h->read < w) {
+      vs[c++] = h->values[h->read++];
+    }
+  }
+  q->head = h;
+  size_add(q, id, -c);
+  lock_release(&q->lock, id);
+  while (old != h) {
+    node *next = old->next;
+    pool_put_stats(&q->nodes, id, old, s);
+    old = next;
+  }
+  return c;
+}
+
+// dequeue from queue, sleep while it is empty (at most timeout seconds, forever if timeout < 0)
+int deq_wait(value_t *v, queue *q, double timeout) {
+  return wait_deq(&q->waiting, deq, v, q, timeout);
+}
+
+// dequeue from queue, sleep while it is empty (including statistics)
+int deq_wait_stats(value_t *v, queue *q, double timeout, stats *s) {
+  return wait_deq_stats(&q->waiting, deq_stats, v, q, timeout, s);
+}
+
 // length of queue
 int len(queue *q) {
+#if LEN == LEN_EXACT
+  int id = omp_get_thread_num();
+  lock_acquire(&q->lock, id);
+  long c = q->size;
+  lock_release(&q->lock, id);
+  return (int)c;
+#elif LEN == LEN_SHARDED
+  return count_len(&q->count);
+#else
   node *n = q->head;
-  n = n->next;
   int c = 0;
   while (n != NULL) {
-    c++;
+    c += n->write - n->read;
     n = n->next;
   }
   return c;
+#endif
 }
 
 // destroy queue
 void destroy(queue *q) {
-  node *n = q->head;
-  while (n != NULL) {
-    node *next = n->next;
-    free(n);
-    n = next;
-  }
-
-  for (int i = 0; i < q->max_threads; i++) {
-    n = q->freelists[i];
-    while (n != NULL) {
-      node *next = n->next;
-      free(n);
-      n = next;
-    }
-  }
-  free(q->freelists);
-  omp_destroy_lock(&q->lock);
+  pool_destroy(&q->nodes);
+  slab_destroy(&q->arena);
+  free(q->spares);
+  lock_destroy(&q->lock);
+  count_destroy(&q->count);
   free(q);
 }
-
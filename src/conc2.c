@@ -1,26 +1,63 @@
 #include <stdlib.h>
+#include <stdatomic.h>
 #include "queue.h"
+#include "slab.h"
+#include "pool.h"
+#include "wait.h"
+#include "lock.h"
+#include "count.h"
 #include <omp.h>
 
-// node definition
+// node definition (unrolled, values[read..write) are still in the queue; enqueuers publish write)
 typedef struct node {
-  value_t value;
+  int read;
+  _Atomic(int) write;
   struct node *next;
+  value_t values[UNROLL];
 } node;
 
+// per thread spare node (fetched outside the lock, linked in once the tail node is full)
+typedef struct spare {
+  PADDED node *n;
+} spare;
+
 // queue definition
 typedef struct queue {
-  node *head;
-  node *tail;
-  node **freelists;
+  PADDED node *head;
+  PADDED node *tail;
+  lock lock_enq;
+  lock lock_deq;
+  pool nodes;
+  slab arena;
+  spare *spares;
+  waiter waiting;
+  counter count;
+  PADDED long enqs;  // LEN_EXACT only, guarded by lock_enq
+  PADDED long deqs;  // LEN_EXACT only, guarded by lock_deq
   int max_threads;
-  omp_lock_t lock_enq;
-  omp_lock_t lock_deq;
 } queue;
 
+// n values went in, called under lock_enq
+static void enqs_add(queue *q, int id, long n) {
+#if LEN == LEN_EXACT
+  q->enqs += n;
+#else
+  count_enq(&q->count, id, n);
+#endif
+}
+
+// n values went out, called under lock_deq
+static void deqs_add(queue *q, int id, long n) {
+#if LEN == LEN_EXACT
+  q->deqs += n;
+#else
+  count_deq(&q->count, id, n);
+#endif
+}
+
 // create queue
 queue* create() {
-  queue *q = (queue*)malloc(sizeof(queue));
+  queue *q = (queue*)calloc_padded(1, sizeof(queue));
   if (!q) { return NULL; }  // buy more RAM
   return q;
 }
@@ -28,145 +65,367 @@ queue* create() {
 // initialize queue
 int init(queue *q) {
   q->max_threads = omp_get_max_threads();
-  q->freelists = (node**)calloc(q->max_threads, sizeof(node*));
-  if (q->freelists == NULL) { return QUEUE_NOMEM; }  // buy more RAM
-  node *n = (node*)malloc(sizeof(node));
+  // nodes belong to the slab, the pool recycles them and hands back what it does not keep
+  int ret_pool = pool_init(&q->nodes, q->max_threads, &q->arena);
+  int ret_slab = slab_init(&q->arena, sizeof(node), q->max_threads);
+  q->spares = (spare*)calloc_padded(q->max_threads, sizeof(spare));
+  int ret_enq = lock_init(&q->lock_enq, q->max_threads);
+  int ret_deq = lock_init(&q->lock_deq, q->max_threads);
+  int ret_count = count_init(&q->count, q->max_threads);
+  if (ret_pool != QUEUE_OK || ret_slab != QUEUE_OK || q->spares == NULL || ret_enq != QUEUE_OK || ret_deq != QUEUE_OK ||
+      ret_count != QUEUE_OK) {
+    pool_destroy(&q->nodes);
+    slab_destroy(&q->arena);
+    free(q->spares);
+    lock_destroy(&q->lock_enq);
+    lock_destroy(&q->lock_deq);
+    count_destroy(&q->count);
+    return QUEUE_NOMEM;
+  }  // buy more RAM
+  node *n = (node*)slab_alloc(&q->arena, omp_get_thread_num());
   if (n == NULL) {
-    free(q->freelists);
+    pool_destroy(&q->nodes);
+    slab_destroy(&q->arena);
+    free(q->spares);
+    lock_destroy(&q->lock_enq);
+    lock_destroy(&q->lock_deq);
+    count_destroy(&q->count);
     return QUEUE_NOMEM;
   }  // buy more RAM
+  n->read = 0;
+  atomic_store(&n->write, 0);
   n->next = NULL;
   q->head = n;
   q->tail = n;
-  omp_init_lock(&q->lock_enq);
-  omp_init_lock(&q->lock_deq);
+  q->enqs = 0;
+  q->deqs = 0;
+  wait_init(&q->waiting);
   return QUEUE_OK;
 }
 
+// get empty node from pool or slab (NULL if out of memory)
+static node *node_get(queue *q, int id) {
+  node *n = (node*)pool_get(&q->nodes, id);
+  if (n == NULL) {
+    n = (node*)slab_alloc(&q->arena, id);
+    if (n == NULL) { return NULL; }  // buy more RAM
+  }
+  n->read = 0;
+  atomic_store(&n->write, 0);
+  n->next = NULL;
+  return n;
+}
+
+// get empty node from pool or slab (including statistics)
+static node *node_get_stats(queue *q, int id, stats *s) {
+  node *n = (node*)pool_get_stats(&q->nodes, id, s);
+  if (n == NULL) {
+    n = (node*)slab_alloc_stats(&q->arena, id, s);
+    if (n == NULL) { return NULL; }  // buy more RAM
+  }
+  n->read = 0;
+  atomic_store(&n->write, 0);
+  n->next = NULL;
+  return n;
+}
+
 // enqueue in queue
 int enq(value_t v, queue *q) {
-  omp_set_lock(&q->lock_enq);
   int id = omp_get_thread_num();
-  node *n;
-  if (q->freelists[id] == NULL) {
-    n = (node*)malloc(sizeof(node));
-    if (n == NULL) {  // buy more RAM
-      omp_unset_lock(&q->lock_enq);
-      return QUEUE_NOMEM;
-    }
+  node *n = q->spares[id].n;
+  if (n == NULL) {
+    n = node_get(q, id);
+    q->spares[id].n = n;
+  }
+  lock_acquire(&q->lock_enq, id);
+  node *t = q->tail;
+  int w = atomic_load(&t->write);
+  if (w < UNROLL) {
+    t->values[w] = v;
+    atomic_store(&t->write, w + 1);
+  } else if (n != NULL) {
+    n->values[0] = v;
+    atomic_store(&n->write, 1);
+    t->next = n;
+    q->tail = n;
+    q->spares[id].n = NULL;
   } else {
-    n = q->freelists[id];
-    q->freelists[id] = n->next;
+    lock_release(&q->lock_enq, id);
+    return QUEUE_NOMEM;  // buy more RAM
   }
-  n->next = NULL;
-  n->value = v;
-  q->tail->next = n;
-  q->tail = n;
-  omp_unset_lock(&q->lock_enq);
+  enqs_add(q, id, 1);
+  lock_release(&q->lock_enq, id);
+  wait_wake(&q->waiting, 1);
   return QUEUE_OK;
 }
 
 // enqueue in queue (including statistics)
 int enq_stats(value_t v, queue *q, stats *s) {
-  omp_set_lock(&q->lock_enq);
   int id = omp_get_thread_num();
-  node *n;
-  if (q->freelists[id] == NULL) {
-    n = (node*)malloc(sizeof(node));
-    if (n == NULL) {  // buy more RAM
-      omp_unset_lock(&q->lock_enq);
-      return QUEUE_NOMEM;
-    }
+  node *n = q->spares[id].n;
+  if (n == NULL) {
+    n = node_get_stats(q, id, s);
+    q->spares[id].n = n;
+  }
+  lock_acquire(&q->lock_enq, id);
+  node *t = q->tail;
+  int w = atomic_load(&t->write);
+  if (w < UNROLL) {
+    t->values[w] = v;
+    atomic_store(&t->write, w + 1);
+  } else if (n != NULL) {
+    n->values[0] = v;
+    atomic_store(&n->write, 1);
+    t->next = n;
+    q->tail = n;
+    q->spares[id].n = NULL;
   } else {
-    n = q->freelists[id];
-    q->freelists[id] = n->next;
-    s->freelist_len--;
+    lock_release(&q->lock_enq, id);
+    return QUEUE_NOMEM;  // buy more RAM
   }
-  n->next = NULL;
-  n->value = v;
-  q->tail->next = n;
-  q->tail = n;
-  omp_unset_lock(&q->lock_enq);
+  enqs_add(q, id, 1);
+  lock_release(&q->lock_enq, id);
+  wait_wake_stats(&q->waiting, 1, s);
   return QUEUE_OK;
 }
 
 // dequeue from queue
 int deq(value_t *v, queue *q) {
-  omp_set_lock(&q->lock_deq);
   int id = omp_get_thread_num();
-  node *old;
-  node *new;
-  old = q->head;
-  new = old->next;
-  if (new == NULL) {
-    omp_unset_lock(&q->lock_deq);
-    return QUEUE_EMPTY;
-  }
-  *v = new->value;
-  q->head = new;
-  old->next = q->freelists[id];
-  q->freelists[id] = old;
-  omp_unset_lock(&q->lock_deq);
+  lock_acquire(&q->lock_deq, id);
+  node *old = q->head;
+  node *h = old;
+  if (h->read == atomic_load(&h->write)) {
+    node *new = h->next;
+    if (new == NULL) {
+      lock_release(&q->lock_deq, id);
+      return QUEUE_EMPTY;
+    }
+    // node may have been filled up (or closed by a batch) before new got linked
+    if (h->read == atomic_load(&h->write)) {
+      h = new;
+      q->head = h;
+    }
+  }
+  *v = h->values[h->read++];
+  deqs_add(q, id, 1);
+  lock_release(&q->lock_deq, id);
+  if (h != old) { pool_put(&q->nodes, id, old); }
   return QUEUE_OK;
 }
 
 // dequeue from queue (including statistics)
 int deq_stats(value_t *v, queue *q, stats *s) {
-  omp_set_lock(&q->lock_deq);
   int id = omp_get_thread_num();
-  node *old;
-  node *new;
-  old = q->head;
-  new = old->next;
-  if (new == NULL) {
-    omp_unset_lock(&q->lock_deq);
-    return QUEUE_EMPTY;
-  }
-  *v = new->value;
-  q->head = new;
-  old->next = q->freelists[id];
-  q->freelists[id] = old;
-  s->freelist_len++;
-  if (s->freelist_len > s->freelist_max) {
-    s->freelist_max = s->freelist_len;
-  }
-  s->freelist_insert++;
-  omp_unset_lock(&q->lock_deq);
+  lock_acquire(&q->lock_deq, id);
+  node *old = q->head;
+  node *h = old;
+  if (h->read == atomic_load(&h->write)) {
+    node *new = h->next;
+    if (new == NULL) {
+      lock_release(&q->lock_deq, id);
+      return QUEUE_EMPTY;
+    }
+    // node may have been filled up (or closed by a batch) before new got linked
+    if (h->read == atomic_load(&h->write)) {
+      h = new;
+      q->head = h;
+    }
+  }
+  *v = h->values[h->read++];
+  deqs_add(q, id, 1);
+  lock_release(&q->lock_deq, id);
+  if (h != old) { pool_put_stats(&q->nodes, id, old, s); }
   return QUEUE_OK;
 }
 
+// enqueue multiple values in queue (returns number of enqueued values)
+int enq_batch(const value_t *vs, int n, queue *q) {
+  if (n <= 0) { return 0; }
+  int id = omp_get_thread_num();
+  // reserve enough nodes outside the lock, unused ones go back to the pool
+  node *rest = NULL;
+  for (int k = 0; k < (n + UNROLL - 1) / UNROLL; k++) {
+    node *nd = node_get(q, id);
+    if (nd == NULL) { break; }  // buy more RAM
+    nd->next = rest;
+    rest = nd;
+  }
+  lock_acquire(&q->lock_enq, id);
+  node *t = q->tail;
+  int w = atomic_load(&t->write);
+  int c = 0;
+  while (c < n && w < UNROLL) {
+    t->values[w++] = vs[c++];
+  }
+  atomic_store(&t->write, w);
+  while (c < n && rest != NULL) {
+    node *nd = rest;
+    rest = nd->next;
+    nd->next = NULL;
+    for (w = 0; c < n && w < UNROLL; w++) {
+      nd->values[w] = vs[c++];
+    }
+    atomic_store(&nd->write, w);
+    t->next = nd;
+    t = nd;
+  }
+  q->tail = t;
+  enqs_add(q, id, c);
+  lock_release(&q->lock_enq, id);
+  while (rest != NULL) {
+    node *next = rest->next;
+    pool_put(&q->nodes, id, rest);
+    rest = next;
+  }
+  wait_wake(&q->waiting, c);
+  return c;
+}
+
+// enqueue multiple values in queue (including statistics)
+int enq_batch_stats(const value_t *vs, int n, queue *q, stats *s) {
+  if (n <= 0) { return 0; }
+  int id = omp_get_thread_num();
+  // reserve enough nodes outside the lock, unused ones go back to the pool
+  node *rest = NULL;
+  for (int k = 0; k < (n + UNROLL - 1) / UNROLL; k++) {
+    node *nd = node_get_stats(q, id, s);
+    if (nd == NULL) { break; }  // buy more RAM
+    nd->next = rest;
+    rest = nd;
+  }
+  lock_acquire(&q->lock_enq, id);
+  node *t = q->tail;
+  int w = atomic_load(&t->write);
+  int c = 0;
+  while (c < n && w < UNROLL) {
+    t->values[w++] = vs[c++];
+  }
+  atomic_store(&t->write, w);
+  while (c < n && rest != NULL) {
+    node *nd = rest;
+    rest = nd->next;
+    nd->next = NULL;
+    for (w = 0; c < n && w < UNROLL; w++) {
+      nd->values[w] = vs[c++];
+    }
+    atomic_store(&nd->write, w);
+    t->next = nd;
+    t = nd;
+  }
+  q->tail = t;
+  enqs_add(q, id, c);
+  lock_release(&q->lock_enq, id);
+  while (rest != NULL) {
+    node *next = rest->next;
+    pool_put_stats(&q->nodes, id, rest, s);
+    rest = next;
+  }
+  wait_wake_stats(&q->waiting, c, s);
+  return c;
+}
+
+// dequeue up to max values from queue (returns number of dequeued values)
+int deq_batch(value_t *vs, int max, queue *q) {
+  int id = omp_get_thread_num();
+  lock_acquire(&q->lock_deq, id);
+  node *old = q->head;
+  node *h = old;
+  int c = 0;
+  while (c < max) {
+    int w = atomic_load(&h->write);
+    if (h->read == w) {
+      node *new = h->next;
+      if (new == NULL) { break; }
+      if (h->read == atomic_load(&h->write)) { h = new; }
+      continue;
+    }
+    while (c < max && h->read < w) {
+      vs[c++] = h->values[h->read++];
+    }
+  }
+  q->head = h;
+  deqs_add(q, id, c);
+  lock_release(&q->lock_deq, id);
+  while (old != h) {
+    node *next = old->next;
+    pool_put(&q->nodes, id, old);
+    old = next;
+  }
+  return c;
+}
+
+// dequeue up to max values from queue (including statistics)
+int deq_batch_stats(value_t *vs, int max, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  lock_acquire(&q->lock_deq, id);
+  node *old = q->head;
+  node *h = old;
+  int c = 0;
+  while (c < max) {
+    int w = atomic_load(&h->write);
+    if (h->read == w) {
+      node *new = h->next;
+      if (new == NULL) { break; }
+      if (h->read == atomic_load(&h->write)) { h = new; }
+      continue;
+    }
+    while (c < max && h->read < w) {
+      vs[c++] = h->values[h->read++];
+    }
+  }
+  q->head = h;
+  deqs_add(q, id, c);
+  lock_release(&q->lock_deq, id);
+  while (old != h) {
+    node *next = old->next;
+    pool_put_stats(&q->nodes, id, old, s);
+    old = next;
+  }
+  return c;
+}
+
+// dequeue from queue, sleep while it is empty (at most timeout seconds, forever if timeout < 0)
+int deq_wait(value_t *v, queue *q, double timeout) {
+  return wait_deq(&q->waiting, deq, v, q, timeout);
+}
+
+// dequeue from queue, sleep while it is empty (including statistics)
+int deq_wait_stats(value_t *v, queue *q, double timeout, stats *s) {
+  return wait_deq_stats(&q->waiting, deq_stats, v, q, timeout, s);
+}
+
 // length of queue
 int len(queue *q) {
+#if LEN == LEN_EXACT
+  // both locks (enq before deq, nobody else holds both) stop the queue for a moment
+  int id = omp_get_thread_num();
+  lock_acquire(&q->lock_enq, id);
+  lock_acquire(&q->lock_deq, id);
+  long c = q->enqs - q->deqs;
+  lock_release(&q->lock_deq, id);
+  lock_release(&q->lock_enq, id);
+  return (int)c;
+#elif LEN == LEN_SHARDED
+  return count_len(&q->count);
+#else
   node *n = q->head;
-  n = n->next;
   int c = 0;
   while (n != NULL) {
-    c++;
+    c += atomic_load(&n->write) - n->read;
     n = n->next;
   }
   return c;
+#endif
 }
 
 // destroy queue
 void destroy(queue *q) {
-  node *n = q->head;
-  while (n != NULL) {
-    node *next = n->next;
-    free(n);
-    n = next;
-  }
-
-  for (int i = 0; i < q->max_threads; i++) {
-    n = q->freelists[i];
-    while (n != NULL) {
-      node *next = n->next;
-      free(n);
-      n = next;
-    }
-  }
-  free(q->freelists);
-  omp_destroy_lock(&q->lock_enq);
-  omp_destroy_lock(&q->lock_deq);
+  pool_destroy(&q->nodes);
+  slab_destroy(&q->arena);
+  free(q->spares);
+  lock_destroy(&q->lock_enq);
+  lock_destroy(&q->lock_deq);
+  count_destroy(&q->count);
   free(q);
 }
-
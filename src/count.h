@@ -0,0 +1,79 @@
+#ifndef COUNT_H
+#define COUNT_H
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "queue.h"
+
+// how len() gets the length of a queue
+#define LEN_WALK    0  // walk the queue (O(n), no bookkeeping in enq/deq)
+#define LEN_SHARDED 1  // sum up per thread counters of enqueued and dequeued values (O(threads))
+#define LEN_EXACT   2  // lock based variants: count under the lock and take it in len(), others count sharded
+
+// len() of the build (e.g. -DLEN=LEN_EXACT)
+#ifndef LEN
+#define LEN LEN_SHARDED
+#endif
+
+// per thread counters (only written by their owner, a plain load and store instead of an atomic add)
+typedef struct count_local {
+  PADDED _Atomic(long) enqs;
+  _Atomic(long) deqs;
+} count_local;
+
+// sharded counters of a queue; their difference is off by at most the values of the operations in flight
+typedef struct counter {
+  count_local *locals;
+  int max_threads;
+} counter;
+
+// initialize counters for max_threads threads
+static int count_init(counter *c, int max_threads) {
+  c->max_threads = max_threads;
+#if LEN != LEN_WALK
+  c->locals = (count_local*)calloc_padded(max_threads, sizeof(count_local));
+  if (c->locals == NULL) { return QUEUE_NOMEM; }  // buy more RAM
+#else
+  c->locals = NULL;
+#endif
+  return QUEUE_OK;
+}
+
+// add to a counter of the calling thread
+static void count_add(_Atomic(long) *x, long n) {
+  atomic_store_explicit(x, atomic_load_explicit(x, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// thread id enqueued n values
+static void count_enq(counter *c, int id, long n) {
+#if LEN != LEN_WALK
+  count_add(&c->locals[id].enqs, n);
+#endif
+}
+
+// thread id dequeued n values
+static void count_deq(counter *c, int id, long n) {
+#if LEN != LEN_WALK
+  count_add(&c->locals[id].deqs, n);
+#endif
+}
+
+// values in the queue (clamped at 0, the dequeue of a value may get counted before its enqueue)
+static int count_len(counter *c) {
+  long deqs = 0;
+  long enqs = 0;
+  for (int i = 0; i < c->max_threads; i++) {
+    deqs += atomic_load_explicit(&c->locals[i].deqs, memory_order_relaxed);
+  }
+  for (int i = 0; i < c->max_threads; i++) {
+    enqs += atomic_load_explicit(&c->locals[i].enqs, memory_order_relaxed);
+  }
+  return enqs > deqs ? (int)(enqs - deqs) : 0;
+}
+
+// destroy counters
+static void count_destroy(counter *c) {
+  free(c->locals);
+}
+
+#endif
@@ -0,0 +1,541 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "queue.h"
+#include "wait.h"
+#include "count.h"
+#include <omp.h>
+
+#define CAS atomic_compare_exchange_strong // weak|strong
+
+// number of slots per segment
+#ifndef SEG_SIZE
+#define SEG_SIZE 1024
+#endif
+
+// slot states
+#define SLOT_EMPTY 0
+#define SLOT_FULL  1
+#define SLOT_TAKEN 2
+
+// slot definition
+typedef struct slot {
+  _Atomic(int) state;
+  value_t value;
+} slot;
+
+// segment definition (ring of slots, claimed via fetch-and-add tickets)
+typedef struct segment {
+  _Atomic(long) enq_idx;
+  _Atomic(long) deq_idx;
+  _Atomic(struct segment*) next;
+  struct segment *retired_next;
+  slot slots[SEG_SIZE];
+} segment;
+
+// per thread hazard pointer and retired segments
+typedef struct seg_local {
+  PADDED _Atomic(segment*) hazard;
+  segment *retired;
+  int retired_len;
+} seg_local;
+
+// queue definition
+typedef struct queue {
+  PADDED _Atomic(segment*) head;
+  PADDED _Atomic(segment*) tail;
+  seg_local *locals;
+  waiter waiting;
+  counter count;
+  int max_threads;
+} queue;
+
+// allocate empty segment
+static segment *seg_alloc() {
+  segment *seg = (segment*)calloc(1, sizeof(segment));
+  if (seg == NULL) { return NULL; }  // buy more RAM
+  atomic_store(&seg->enq_idx, 0);
+  atomic_store(&seg->deq_idx, 0);
+  atomic_store(&seg->next, NULL);
+  return seg;
+}
+
+// read segment pointer and publish it as hazardous for this thread
+static segment *seg_protect(queue *q, _Atomic(segment*) *src, int id) {
+  segment *seg = atomic_load(src);
+  while(1) {
+    atomic_store(&q->locals[id].hazard, seg);
+    segment *check = atomic_load(src);
+    if (check == seg) { return seg; }
+    seg = check;
+  }
+}
+
+// clear hazard pointer of this thread
+static void seg_release(queue *q, int id) {
+  atomic_store(&q->locals[id].hazard, NULL);
+}
+
+// retire segment; frees all retired segments no thread holds a hazard pointer to
+static void seg_retire(queue *q, segment *seg, int id) {
+  seg_local *l = &q->locals[id];
+  seg->retired_next = l->retired;
+  l->retired = seg;
+  l->retired_len++;
+  if (l->retired_len < 2 * q->max_threads) { return; }
+
+  segment *keep = NULL;
+  int kept = 0;
+  seg = l->retired;
+  while (seg != NULL) {
+    segment *next = seg->retired_next;
+    int hazardous = 0;
+    for (int i = 0; i < q->max_threads; i++) {
+      if (atomic_load(&q->locals[i].hazard) == seg) {
+        hazardous = 1;
+        break;
+      }
+    }
+    if (hazardous) {
+      seg->retired_next = keep;
+      keep = seg;
+      kept++;
+    } else {
+      free(seg);
+    }
+    seg = next;
+  }
+  l->retired = keep;
+  l->retired_len = kept;
+}
+
+// create queue
+queue* create() {
+  queue *q = (queue*)calloc_padded(1, sizeof(queue));
+  if (!q) { return NULL; }  // buy more RAM
+  return q;
+}
+
+// initialize queue
+int init(queue *q) {
+  q->max_threads = omp_get_max_threads();
+  q->locals = (seg_local*)calloc_padded(q->max_threads, sizeof(seg_local));
+  segment *seg = seg_alloc();
+  int ret_count = count_init(&q->count, q->max_threads);
+  if (q->locals == NULL || seg == NULL || ret_count != QUEUE_OK) {  // buy more RAM
+    free(q->locals);
+    free(seg);
+    count_destroy(&q->count);
+    return QUEUE_NOMEM;
+  }
+  for (int i = 0; i < q->max_threads; i++) {
+    atomic_store(&q->locals[i].hazard, NULL);
+  }
+  atomic_store(&q->head, seg);
+  atomic_store(&q->tail, seg);
+  wait_init(&q->waiting);
+  return QUEUE_OK;
+}
+
+// enqueue in queue
+int enq(value_t v, queue *q) {
+  int id = omp_get_thread_num();
+  while(1) {
+    segment *tail = seg_protect(q, &q->tail, id);
+    long idx = atomic_fetch_add(&tail->enq_idx, 1);
+    if (idx < SEG_SIZE) {
+      slot *sl = &tail->slots[idx];
+      sl->value = v;
+      int expected = SLOT_EMPTY;
+      if (CAS(&sl->state, &expected, SLOT_FULL)) {
+        seg_release(q, id);
+        count_enq(&q->count, id, 1);
+        wait_wake(&q->waiting, 1);
+        return QUEUE_OK;
+      }
+      continue;  // slot got taken by a dequeuer in the meantime
+    }
+
+    // segment is closed, append or help appending a new one
+    if (tail != atomic_load(&q->tail)) { continue; }
+    segment *next = atomic_load(&tail->next);
+    if (next == NULL) {
+      segment *seg = seg_alloc();
+      if (seg == NULL) {  // buy more RAM
+        seg_release(q, id);
+        return QUEUE_NOMEM;
+      }
+      seg->slots[0].value = v;
+      atomic_store(&seg->slots[0].state, SLOT_FULL);
+      atomic_store(&seg->enq_idx, 1);
+      if (CAS(&tail->next, &next, seg)) {
+        CAS(&q->tail, &tail, seg);
+        seg_release(q, id);
+        count_enq(&q->count, id, 1);
+        wait_wake(&q->waiting, 1);
+        return QUEUE_OK;
+      }
+      free(seg);  // never published
+    } else {
+      CAS(&q->tail, &tail, next);
+    }
+  }
+}
+
+// enqueue in queue (including statistics)
+int enq_stats(value_t v, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  while(1) {
+    segment *tail = seg_protect(q, &q->tail, id);
+    long idx = atomic_fetch_add(&tail->enq_idx, 1);
+    if (idx < SEG_SIZE) {
+      slot *sl = &tail->slots[idx];
+      sl->value = v;
+      int expected = SLOT_EMPTY;
+      if (CAS(&sl->state, &expected, SLOT_FULL)) {
+        s->cas_succ++;
+        seg_release(q, id);
+        count_enq(&q->count, id, 1);
+        wait_wake_stats(&q->waiting, 1, s);
+        return QUEUE_OK;
+      }
+      s->cas_fail++;
+      continue;  // slot got taken by a dequeuer in the meantime
+    }
+
+    // segment is closed, append or help appending a new one
+    if (tail != atomic_load(&q->tail)) { continue; }
+    segment *next = atomic_load(&tail->next);
+    if (next == NULL) {
+      segment *seg = seg_alloc();
+      if (seg == NULL) {  // buy more RAM
+        seg_release(q, id);
+        return QUEUE_NOMEM;
+      }
+      s->seg_alloc++;
+      seg->slots[0].value = v;
+      atomic_store(&seg->slots[0].state, SLOT_FULL);
+      atomic_store(&seg->enq_idx, 1);
+      if (CAS(&tail->next, &next, seg)) {
+        s->cas_succ++;
+        if (CAS(&q->tail, &tail, seg)) { s->cas_succ++; } else { s->cas_fail++; }
+        seg_release(q, id);
+        count_enq(&q->count, id, 1);
+        wait_wake_stats(&q->waiting, 1, s);
+        return QUEUE_OK;
+      }
+      s->cas_fail++;
+      free(seg);  // never published
+    } else {
+      if (CAS(&q->tail, &tail, next)) { s->cas_succ++; } else { s->cas_fail++; }
+    }
+  }
+}
+
+// dequeue from queue
+int deq(value_t *v, queue *q) {
+  int id = omp_get_thread_num();
+  while(1) {
+    segment *head = seg_protect(q, &q->head, id);
+    if (atomic_load(&head->deq_idx) >= atomic_load(&head->enq_idx) && atomic_load(&head->next) == NULL) {
+      seg_release(q, id);
+      return QUEUE_EMPTY;
+    }
+    long idx = atomic_fetch_add(&head->deq_idx, 1);
+    if (idx < SEG_SIZE) {
+      slot *sl = &head->slots[idx];
+      if (atomic_exchange(&sl->state, SLOT_TAKEN) == SLOT_FULL) {
+        *v = sl->value;
+        seg_release(q, id);
+        count_deq(&q->count, id, 1);
+        return QUEUE_OK;
+      }
+      continue;  // enqueuer did not fill the slot yet, it will retry elsewhere
+    }
+
+    // segment is drained, move on to the next one
+    segment *next = atomic_load(&head->next);
+    if (next == NULL) {
+      seg_release(q, id);
+      return QUEUE_EMPTY;
+    }
+    if (CAS(&q->head, &head, next)) {
+      seg_release(q, id);
+      seg_retire(q, head, id);
+    }
+  }
+}
+
+// dequeue from queue (including statistics)
+int deq_stats(value_t *v, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  while(1) {
+    segment *head = seg_protect(q, &q->head, id);
+    if (atomic_load(&head->deq_idx) >= atomic_load(&head->enq_idx) && atomic_load(&head->next) == NULL) {
+      seg_release(q, id);
+      return QUEUE_EMPTY;
+    }
+    long idx = atomic_fetch_add(&head->deq_idx, 1);
+    if (idx < SEG_SIZE) {
+      slot *sl = &head->slots[idx];
+      if (atomic_exchange(&sl->state, SLOT_TAKEN) == SLOT_FULL) {
+        *v = sl->value;
+        seg_release(q, id);
+        count_deq(&q->count, id, 1);
+        return QUEUE_OK;
+      }
+      continue;  // enqueuer did not fill the slot yet, it will retry elsewhere
+    }
+
+    // segment is drained, move on to the next one
+    segment *next = atomic_load(&head->next);
+    if (next == NULL) {
+      seg_release(q, id);
+      return QUEUE_EMPTY;
+    }
+    if (CAS(&q->head, &head, next)) {
+      s->cas_succ++;
+      seg_release(q, id);
+      seg_retire(q, head, id);
+    } else { s->cas_fail++; }
+  }
+}
+
+// enqueue multiple values in queue (returns number of enqueued values)
+int enq_batch(const value_t *vs, int n, queue *q) {
+  int id = omp_get_thread_num();
+  int c = 0;
+  while (c < n) {
+    segment *tail = seg_protect(q, &q->tail, id);
+    long idx = atomic_fetch_add(&tail->enq_idx, n - c);
+    if (idx < SEG_SIZE) {
+      // fill claimed slots in order, give up the rest once a dequeuer took one
+      long end = idx + (n - c) < SEG_SIZE ? idx + (n - c) : SEG_SIZE;
+      int lost = 0;
+      for (long i = idx; i < end; i++) {
+        slot *sl = &tail->slots[i];
+        int expected = SLOT_EMPTY;
+        if (lost) {
+          CAS(&sl->state, &expected, SLOT_TAKEN);
+          continue;
+        }
+        sl->value = vs[c];
+        if (CAS(&sl->state, &expected, SLOT_FULL)) {
+          c++;
+        } else {
+          lost = 1;
+        }
+      }
+      continue;
+    }
+
+    // segment is closed, append or help appending a new one holding the rest of the batch
+    if (tail != atomic_load(&q->tail)) { continue; }
+    segment *next = atomic_load(&tail->next);
+    if (next == NULL) {
+      segment *seg = seg_alloc();
+      if (seg == NULL) { break; }  // buy more RAM
+      int m = n - c < SEG_SIZE ? n - c : SEG_SIZE;
+      for (int i = 0; i < m; i++) {
+        seg->slots[i].value = vs[c + i];
+        atomic_store(&seg->slots[i].state, SLOT_FULL);
+      }
+      atomic_store(&seg->enq_idx, m);
+      if (CAS(&tail->next, &next, seg)) {
+        CAS(&q->tail, &tail, seg);
+        c += m;
+        continue;
+      }
+      free(seg);  // never published
+    } else {
+      CAS(&q->tail, &tail, next);
+    }
+  }
+  seg_release(q, id);
+  count_enq(&q->count, id, c);
+  wait_wake(&q->waiting, c);
+  return c;
+}
+
+// enqueue multiple values in queue (including statistics)
+int enq_batch_stats(const value_t *vs, int n, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  int c = 0;
+  while (c < n) {
+    segment *tail = seg_protect(q, &q->tail, id);
+    long idx = atomic_fetch_add(&tail->enq_idx, n - c);
+    if (idx < SEG_SIZE) {
+      // fill claimed slots in order, give up the rest once a dequeuer took one
+      long end = idx + (n - c) < SEG_SIZE ? idx + (n - c) : SEG_SIZE;
+      int lost = 0;
+      for (long i = idx; i < end; i++) {
+        slot *sl = &tail->slots[i];
+        int expected = SLOT_EMPTY;
+        if (lost) {
+          CAS(&sl->state, &expected, SLOT_TAKEN);
+          continue;
+        }
+        sl->value = vs[c];
+        if (CAS(&sl->state, &expected, SLOT_FULL)) {
+          s->cas_succ++;
+          c++;
+        } else {
+          s->cas_fail++;
+          lost = 1;
+        }
+      }
+      continue;
+    }
+
+    // segment is closed, append or help appending a new one holding the rest of the batch
+    if (tail != atomic_load(&q->tail)) { continue; }
+    segment *next = atomic_load(&tail->next);
+    if (next == NULL) {
+      segment *seg = seg_alloc();
+      if (seg == NULL) { break; }  // buy more RAM
+      s->seg_alloc++;
+      int m = n - c < SEG_SIZE ? n - c : SEG_SIZE;
+      for (int i = 0; i < m; i++) {
+        seg->slots[i].value = vs[c + i];
+        atomic_store(&seg->slots[i].state, SLOT_FULL);
+      }
+      atomic_store(&seg->enq_idx, m);
+      if (CAS(&tail->next, &next, seg)) {
+        s->cas_succ++;
+        if (CAS(&q->tail, &tail, seg)) { s->cas_succ++; } else { s->cas_fail++; }
+        c += m;
+        continue;
+      }
+      s->cas_fail++;
+      free(seg);  // never published
+    } else {
+      if (CAS(&q->tail, &tail, next)) { s->cas_succ++; } else { s->cas_fail++; }
+    }
+  }
+  seg_release(q, id);
+  count_enq(&q->count, id, c);
+  wait_wake_stats(&q->waiting, c, s);
+  return c;
+}
+
+// dequeue up to max values from queue (returns number of dequeued values)
+int deq_batch(value_t *vs, int max, queue *q) {
+  int id = omp_get_thread_num();
+  int c = 0;
+  while (c == 0 && max > 0) {
+    segment *head = seg_protect(q, &q->head, id);
+    long avail = atomic_load(&head->enq_idx) - atomic_load(&head->deq_idx);
+    if (avail <= 0 && atomic_load(&head->next) == NULL) { break; }
+    if (avail > max) { avail = max; }
+    if (avail < 1) { avail = 1; }
+    long idx = atomic_fetch_add(&head->deq_idx, avail);
+    if (idx < SEG_SIZE) {
+      long end = idx + avail < SEG_SIZE ? idx + avail : SEG_SIZE;
+      for (long i = idx; i < end; i++) {
+        slot *sl = &head->slots[i];
+        if (atomic_exchange(&sl->state, SLOT_TAKEN) == SLOT_FULL) {
+          vs[c++] = sl->value;
+        }
+      }
+      continue;
+    }
+
+    // segment is drained, move on to the next one
+    segment *next = atomic_load(&head->next);
+    if (next == NULL) { break; }
+    if (CAS(&q->head, &head, next)) {
+      seg_release(q, id);
+      seg_retire(q, head, id);
+    }
+  }
+  seg_release(q, id);
+  count_deq(&q->count, id, c);
+  return c;
+}
+
+// dequeue up to max values from queue (including statistics)
+int deq_batch_stats(value_t *vs, int max, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  int c = 0;
+  while (c == 0 && max > 0) {
+    segment *head = seg_protect(q, &q->head, id);
+    long avail = atomic_load(&head->enq_idx) - atomic_load(&head->deq_idx);
+    if (avail <= 0 && atomic_load(&head->next) == NULL) { break; }
+    if (avail > max) { avail = max; }
+    if (avail < 1) { avail = 1; }
+    long idx = atomic_fetch_add(&head->deq_idx, avail);
+    if (idx < SEG_SIZE) {
+      long end = idx + avail < SEG_SIZE ? idx + avail : SEG_SIZE;
+      for (long i = idx; i < end; i++) {
+        slot *sl = &head->slots[i];
+        if (atomic_exchange(&sl->state, SLOT_TAKEN) == SLOT_FULL) {
+          vs[c++] = sl->value;
+        }
+      }
+      continue;
+    }
+
+    // segment is drained, move on to the next one
+    segment *next = atomic_load(&head->next);
+    if (next == NULL) { break; }
+    if (CAS(&q->head, &head, next)) {
+      s->cas_succ++;
+      seg_release(q, id);
+      seg_retire(q, head, id);
+    } else { s->cas_fail++; }
+  }
+  seg_release(q, id);
+  count_deq(&q->count, id, c);
+  return c;
+}
+
+// dequeue from queue, sleep while it is empty (at most timeout seconds, forever if timeout < 0)
+int deq_wait(value_t *v, queue *q, double timeout) {
+  return wait_deq(&q->waiting, deq, v, q, timeout);
+}
+
+// dequeue from queue, sleep while it is empty (including statistics)
+int deq_wait_stats(value_t *v, queue *q, double timeout, stats *s) {
+  return wait_deq_stats(&q->waiting, deq_stats, v, q, timeout, s);
+}
+
+// length of queue
+int len(queue *q) {
+#if LEN == LEN_WALK
+  segment *seg = atomic_load(&q->head);
+  int c = 0;
+  while (seg != NULL) {
+    long e = atomic_load(&seg->enq_idx);
+    long d = atomic_load(&seg->deq_idx);
+    if (e > SEG_SIZE) { e = SEG_SIZE; }
+    if (d > SEG_SIZE) { d = SEG_SIZE; }
+    if (e > d) { c += (int)(e - d); }
+    seg = atomic_load(&seg->next);
+  }
+  return c;
+#else
+  return count_len(&q->count);
+#endif
+}
+
+// destroy queue
+void destroy(queue *q) {
+  segment *seg = atomic_load(&q->head);
+  while (seg != NULL) {
+    segment *next = atomic_load(&seg->next);
+    free(seg);
+    seg = next;
+  }
+
+  for (int i = 0; i < q->max_threads; i++) {
+    seg = q->locals[i].retired;
+    while (seg != NULL) {
+      segment *next = seg->retired_next;
+      free(seg);
+      seg = next;
+    }
+  }
+  free(q->locals);
+  count_destroy(&q->count);
+  free(q);
+}
@@ -0,0 +1,274 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "queue.h"
+#include "list.h"
+#include "wait.h"
+#include "count.h"
+#include "lock.h"
+#include <omp.h>
+
+// request kinds
+#define FC_NONE      0
+#define FC_ENQ       1
+#define FC_DEQ       2
+#define FC_ENQ_BATCH 3
+#define FC_DEQ_BATCH 4
+
+// publication record (one per thread, a pending request gets executed by whichever thread holds the lock)
+typedef struct record {
+  PADDED _Atomic(int) op;
+  int ret;
+  int n;
+  value_t value;
+  const value_t *in;
+  value_t *out;
+} record;
+
+// queue definition (flat combining over the sequential list)
+typedef struct queue {
+  PADDED _Atomic(int) lock;
+  list l;
+  record *records;
+  waiter waiting;
+  counter count;
+  int max_threads;
+} queue;
+
+// create queue
+queue* create() {
+  queue *q = (queue*)calloc_padded(1, sizeof(queue));
+  if (!q) { return NULL; }  // buy more RAM
+  return q;
+}
+
+// initialize queue
+int init(queue *q) {
+  q->max_threads = omp_get_max_threads();
+  q->records = (record*)calloc_padded(q->max_threads, sizeof(record));
+  if (q->records == NULL) { return QUEUE_NOMEM; }  // buy more RAM
+  if (count_init(&q->count, q->max_threads) != QUEUE_OK) {
+    free(q->records);
+    return QUEUE_NOMEM;
+  }  // buy more RAM
+  if (list_init(&q->l, q->max_threads, omp_get_thread_num()) != QUEUE_OK) {
+    free(q->records);
+    count_destroy(&q->count);
+    return QUEUE_NOMEM;
+  }  // buy more RAM
+  for (int i = 0; i < q->max_threads; i++) {
+    atomic_store(&q->records[i].op, FC_NONE);
+  }
+  atomic_store(&q->lock, 0);
+  wait_init(&q->waiting);
+  return QUEUE_OK;
+}
+
+// execute request of record on the list (combiner only)
+static void execute(queue *q, int id, record *r, int op) {
+  switch (op) {
+    case FC_ENQ:       r->ret = list_enq(&q->l, id, r->value); break;
+    case FC_DEQ:       r->ret = list_deq(&q->l, id, &r->value); break;
+    case FC_ENQ_BATCH: r->ret = list_enq_batch(&q->l, id, r->in, r->n); break;
+    case FC_DEQ_BATCH: r->ret = list_deq_batch(&q->l, id, r->out, r->n); break;
+  }
+}
+
+// execute request of record on the list (including statistics)
+static void execute_stats(queue *q, int id, record *r, int op, stats *s) {
+  switch (op) {
+    case FC_ENQ:       r->ret = list_enq_stats(&q->l, id, r->value, s); break;
+    case FC_DEQ:       r->ret = list_deq_stats(&q->l, id, &r->value, s); break;
+    case FC_ENQ_BATCH: r->ret = list_enq_batch_stats(&q->l, id, r->in, r->n, s); break;
+    case FC_DEQ_BATCH: r->ret = list_deq_batch_stats(&q->l, id, r->out, r->n, s); break;
+  }
+}
+
+// execute every pending request in one pass over the records (lock has to be held)
+static void combine(queue *q, int id) {
+  for (int i = 0; i < q->max_threads; i++) {
+    record *r = &q->records[i];
+    int op = atomic_load(&r->op);
+    if (op == FC_NONE) { continue; }
+    execute(q, id, r, op);
+    atomic_store(&r->op, FC_NONE);
+  }
+}
+
+// execute every pending request in one pass over the records (including statistics)
+static void combine_stats(queue *q, int id, stats *s) {
+  long c = 0;
+  for (int i = 0; i < q->max_threads; i++) {
+    record *r = &q->records[i];
+    int op = atomic_load(&r->op);
+    if (op == FC_NONE) { continue; }
+    execute_stats(q, id, r, op, s);
+    atomic_store(&r->op, FC_NONE);
+    c++;
+  }
+  s->fc_passes++;
+  s->fc_combined += c;
+  if (c > s->fc_max) {
+    s->fc_max = c;
+  }
+}
+
+// publish request and wait until it got executed (by this thread if it gets the lock)
+static int request(queue *q, int id, int op) {
+  record *r = &q->records[id];
+  atomic_store(&r->op, op);
+  // a preempted combiner must not make every waiter burn its time slice, so waiters yield after a while
+  int spins = 0;
+  while (atomic_load(&r->op) != FC_NONE) {
+    if (atomic_load(&q->lock) == 0 && atomic_exchange(&q->lock, 1) == 0) {
+      combine(q, id);
+      atomic_store(&q->lock, 0);
+    } else {
+      lock_pause(&spins);
+    }
+  }
+  return r->ret;
+}
+
+// publish request and wait until it got executed (including statistics)
+static int request_stats(queue *q, int id, int op, stats *s) {
+  record *r = &q->records[id];
+  atomic_store(&r->op, op);
+  int spins = 0;
+  while (atomic_load(&r->op) != FC_NONE) {
+    if (atomic_load(&q->lock) == 0 && atomic_exchange(&q->lock, 1) == 0) {
+      combine_stats(q, id, s);
+      atomic_store(&q->lock, 0);
+    } else {
+      lock_pause(&spins);
+    }
+  }
+  return r->ret;
+}
+
+// enqueue in queue
+int enq(value_t v, queue *q) {
+  int id = omp_get_thread_num();
+  q->records[id].value = v;
+  int ret = request(q, id, FC_ENQ);
+  if (ret == QUEUE_OK) {
+    count_enq(&q->count, id, 1);
+    wait_wake(&q->waiting, 1);
+  }
+  return ret;
+}
+
+// enqueue in queue (including statistics)
+int enq_stats(value_t v, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  q->records[id].value = v;
+  int ret = request_stats(q, id, FC_ENQ, s);
+  if (ret == QUEUE_OK) {
+    count_enq(&q->count, id, 1);
+    wait_wake_stats(&q->waiting, 1, s);
+  }
+  return ret;
+}
+
+// dequeue from queue
+int deq(value_t *v, queue *q) {
+  int id = omp_get_thread_num();
+  int ret = request(q, id, FC_DEQ);
+  if (ret == QUEUE_OK) {
+    *v = q->records[id].value;
+    count_deq(&q->count, id, 1);
+  }
+  return ret;
+}
+
+// dequeue from queue (including statistics)
+int deq_stats(value_t *v, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  int ret = request_stats(q, id, FC_DEQ, s);
+  if (ret == QUEUE_OK) {
+    *v = q->records[id].value;
+    count_deq(&q->count, id, 1);
+  }
+  return ret;
+}
+
+// enqueue multiple values in queue (returns number of enqueued values)
+int enq_batch(const value_t *vs, int n, queue *q) {
+  if (n <= 0) { return 0; }
+  int id = omp_get_thread_num();
+  q->records[id].in = vs;
+  q->records[id].n = n;
+  int c = request(q, id, FC_ENQ_BATCH);
+  count_enq(&q->count, id, c);
+  wait_wake(&q->waiting, c);
+  return c;
+}
+
+// enqueue multiple values in queue (including statistics)
+int enq_batch_stats(const value_t *vs, int n, queue *q, stats *s) {
+  if (n <= 0) { return 0; }
+  int id = omp_get_thread_num();
+  q->records[id].in = vs;
+  q->records[id].n = n;
+  int c = request_stats(q, id, FC_ENQ_BATCH, s);
+  count_enq(&q->count, id, c);
+  wait_wake_stats(&q->waiting, c, s);
+  return c;
+}
+
+// dequeue up to max values from queue (returns number of dequeued values)
+int deq_batch(value_t *vs, int max, queue *q) {
+  if (max <= 0) { return 0; }
+  int id = omp_get_thread_num();
+  q->records[id].out = vs;
+  q->records[id].n = max;
+  int c = request(q, id, FC_DEQ_BATCH);
+  count_deq(&q->count, id, c);
+  return c;
+}
+
+// dequeue up to max values from queue (including statistics)
+int deq_batch_stats(value_t *vs, int max, queue *q, stats *s) {
+  if (max <= 0) { return 0; }
+  int id = omp_get_thread_num();
+  q->records[id].out = vs;
+  q->records[id].n = max;
+  int c = request_stats(q, id, FC_DEQ_BATCH, s);
+  count_deq(&q->count, id, c);
+  return c;
+}
+
+// dequeue from queue, sleep while it is empty (at most timeout seconds, forever if timeout < 0)
+int deq_wait(value_t *v, queue *q, double timeout) {
+  return wait_deq(&q->waiting, deq, v, q, timeout);
+}
+
+// dequeue from queue, sleep while it is empty (including statistics)
+int deq_wait_stats(value_t *v, queue *q, double timeout, stats *s) {
+  return wait_deq_stats(&q->waiting, deq_stats, v, q, timeout, s);
+}
+
+// length of queue
+int len(queue *q) {
+#if LEN == LEN_EXACT
+  // the combiner lock keeps the list still, its size is exact then
+  int spins = 0;
+  while (atomic_load(&q->lock) != 0 || atomic_exchange(&q->lock, 1) != 0) {
+    lock_pause(&spins);
+  }
+  int c = list_len(&q->l);
+  atomic_store(&q->lock, 0);
+  return c;
+#elif LEN == LEN_SHARDED
+  return count_len(&q->count);
+#else
+  return list_len(&q->l);
+#endif
+}
+
+// destroy queue
+void destroy(queue *q) {
+  list_destroy(&q->l);
+  free(q->records);
+  count_destroy(&q->count);
+  free(q);
+}
@@ -0,0 +1,109 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdio.h>
+#include <time.h>
+
+// log bucketed latency histogram (as in HdrHistogram): every power of two is split into HIST_SUB linear
+// sub-buckets, so a recorded value is off by less than 1 / HIST_SUB (about 3%) at any magnitude
+
+// sub-buckets per power of two (2^HIST_SUB_BITS)
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+// largest recordable value is 2^HIST_MAX_BITS - 1 ns (about 18 minutes), larger ones get clamped
+#define HIST_MAX_BITS 40
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+// histogram definition (values in nanoseconds)
+typedef struct hist {
+  long count;
+  long sum;
+  long max;
+  long buckets[HIST_BUCKETS];
+} hist;
+
+// monotonic time in nanoseconds
+static long hist_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// bucket of value (values below HIST_SUB get a bucket each, above that HIST_SUB buckets per power of two)
+static int hist_bucket(long v) {
+  if (v < HIST_SUB) { return v < 0 ? 0 : (int)v; }
+  if (v >= 1L << HIST_MAX_BITS) { v = (1L << HIST_MAX_BITS) - 1; }
+  int msb = 63 - __builtin_clzl((unsigned long)v);
+  int shift = msb - HIST_SUB_BITS;
+  return (shift + 1) * HIST_SUB + (int)((v >> shift) - HIST_SUB);
+}
+
+// largest value that falls into bucket i
+static long hist_value(int i) {
+  if (i < HIST_SUB) { return i; }
+  int shift = i / HIST_SUB - 1;
+  return ((long)(i % HIST_SUB + HIST_SUB) << shift) + (1L << shift) - 1;
+}
+
+// record value
+static void hist_record(hist *h, long v) {
+  h->buckets[hist_bucket(v)]++;
+  h->count++;
+  h->sum += v;
+  if (v > h->max) {
+    h->max = v;
+  }
+}
+
+// add all values of src to dst
+static void hist_merge(hist *dst, const hist *src) {
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    dst->buckets[i] += src->buckets[i];
+  }
+  dst->count += src->count;
+  dst->sum += src->sum;
+  if (src->max > dst->max) {
+    dst->max = src->max;
+  }
+}
+
+// value below which p percent of the recorded values are (upper end of its bucket, at most the maximum)
+static long hist_percentile(const hist *h, double p) {
+  long rank = (long)(p / 100.0 * h->count + 0.5);
+  if (rank < 1) { rank = 1; }
+  long seen = 0;
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank) {
+      long v = hist_value(i);
+      return v < h->max ? v : h->max;
+    }
+  }
+  return h->max;
+}
+
+// print mean, percentiles and maximum of histogram (nothing if it is empty)
+static void hist_print(const char *name, const hist *h) {
+  if (h->count == 0) { return; }
+  printf(" %s_samples: %ld\n", name, h->count);
+  printf(" %s_mean_ns: %ld\n", name, h->sum / h->count);
+  printf(" %s_p50_ns: %ld\n", name, hist_percentile(h, 50));
+  printf(" %s_p90_ns: %ld\n", name, hist_percentile(h, 90));
+  printf(" %s_p99_ns: %ld\n", name, hist_percentile(h, 99));
+  printf(" %s_p999_ns: %ld\n", name, hist_percentile(h, 99.9));
+  printf(" %s_max_ns: %ld\n", name, h->max);
+}
+
+// mean, percentiles and maximum of histogram as json fields (see json_stats in queue.h)
+static void hist_json(FILE *f, const char *name, const hist *h) {
+  if (h->count == 0) { return; }
+  fprintf(f, ", \"%s_samples\": %ld", name, h->count);
+  fprintf(f, ", \"%s_mean_ns\": %ld", name, h->sum / h->count);
+  fprintf(f, ", \"%s_p50_ns\": %ld", name, hist_percentile(h, 50));
+  fprintf(f, ", \"%s_p90_ns\": %ld", name, hist_percentile(h, 90));
+  fprintf(f, ", \"%s_p99_ns\": %ld", name, hist_percentile(h, 99));
+  fprintf(f, ", \"%s_p999_ns\": %ld", name, hist_percentile(h, 99.9));
+  fprintf(f, ", \"%s_max_ns\": %ld", name, h->max);
+}
+
+#endif
@@ -0,0 +1,275 @@
+#ifndef LIST_H
+#define LIST_H
+
+#include <stdlib.h>
+#include "queue.h"
+#include "slab.h"
+#include "count.h"
+
+// sequential linked list the queues are built on (not thread safe, callers bring their own synchronization)
+
+// node definition (unrolled, values[read..write) are still in the list)
+typedef struct list_node {
+  int read;
+  int write;
+  struct list_node *next;
+  value_t values[UNROLL];
+} list_node;
+
+// per thread freelist
+typedef struct list_freelist {
+  PADDED list_node *head;
+} list_freelist;
+
+// list definition
+typedef struct list {
+  PADDED list_node *head;
+  PADDED list_node *tail;
+  list_freelist *freelists;
+  slab arena;
+  long size;
+  int max_threads;
+} list;
+
+// initialize list (id is the calling thread)
+static int list_init(list *l, int max_threads, int id) {
+  l->max_threads = max_threads;
+  l->freelists = (list_freelist*)calloc_padded(max_threads, sizeof(list_freelist));
+  if (l->freelists == NULL) { return QUEUE_NOMEM; }  // buy more RAM
+  if (slab_init(&l->arena, sizeof(list_node), max_threads) != QUEUE_OK) {
+    free(l->freelists);
+    return QUEUE_NOMEM;
+  }  // buy more RAM
+  list_node *n = (list_node*)slab_alloc(&l->arena, id);
+  if (n == NULL) {
+    free(l->freelists);
+    slab_destroy(&l->arena);
+    return QUEUE_NOMEM;
+  }  // buy more RAM
+  n->read = 0;
+  n->write = 0;
+  n->next = NULL;
+  l->head = n;
+  l->tail = n;
+  l->size = 0;
+  return QUEUE_OK;
+}
+
+// append value to list (nodes come from the freelist of thread id)
+static int list_enq(list *l, int id, value_t v) {
+  list_node *t = l->tail;
+  if (t->write < UNROLL) {
+    t->values[t->write++] = v;
+    l->size++;
+    return QUEUE_OK;
+  }
+  list_node *n;
+  if (l->freelists[id].head == NULL) {
+    n = (list_node*)slab_alloc(&l->arena, id);
+    if (n == NULL) { return QUEUE_NOMEM; }  // buy more RAM
+  } else {
+    n = l->freelists[id].head;
+    l->freelists[id].head = n->next;
+  }
+  n->read = 0;
+  n->write = 1;
+  n->next = NULL;
+  n->values[0] = v;
+  t->next = n;
+  l->tail = n;
+  l->size++;
+  return QUEUE_OK;
+}
+
+// append value to list (including statistics)
+static int list_enq_stats(list *l, int id, value_t v, stats *s) {
+  list_node *t = l->tail;
+  if (t->write < UNROLL) {
+    t->values[t->write++] = v;
+    l->size++;
+    return QUEUE_OK;
+  }
+  list_node *n;
+  if (l->freelists[id].head == NULL) {
+    n = (list_node*)slab_alloc_stats(&l->arena, id, s);
+    if (n == NULL) { return QUEUE_NOMEM; }  // buy more RAM
+  } else {
+    n = l->freelists[id].head;
+    l->freelists[id].head = n->next;
+    s->freelist_len--;
+  }
+  n->read = 0;
+  n->write = 1;
+  n->next = NULL;
+  n->values[0] = v;
+  t->next = n;
+  l->tail = n;
+  l->size++;
+  return QUEUE_OK;
+}
+
+// remove first value from list (emptied nodes go to the freelist of thread id)
+static int list_deq(list *l, int id, value_t *v) {
+  list_node *old = l->head;
+  if (old->read == old->write) {
+    list_node *new = old->next;
+    if (new == NULL) { return QUEUE_EMPTY; }
+    l->head = new;
+    old->next = l->freelists[id].head;
+    l->freelists[id].head = old;
+  }
+  list_node *h = l->head;
+  *v = h->values[h->read++];
+  l->size--;
+  return QUEUE_OK;
+}
+
+// remove first value from list (including statistics)
+static int list_deq_stats(list *l, int id, value_t *v, stats *s) {
+  list_node *old = l->head;
+  if (old->read == old->write) {
+    list_node *new = old->next;
+    if (new == NULL) { return QUEUE_EMPTY; }
+    l->head = new;
+    old->next = l->freelists[id].head;
+    l->freelists[id].head = old;
+    s->freelist_len++;
+    if (s->freelist_len > s->freelist_max) {
+      s->freelist_max = s->freelist_len;
+    }
+    s->freelist_insert++;
+  }
+  list_node *h = l->head;
+  *v = h->values[h->read++];
+  l->size--;
+  return QUEUE_OK;
+}
+
+// append multiple values to list (returns number of appended values)
+static int list_enq_batch(list *l, int id, const value_t *vs, int n) {
+  list_node *t = l->tail;
+  int c = 0;
+  while (c < n) {
+    if (t->write == UNROLL) {
+      list_node *nd;
+      if (l->freelists[id].head == NULL) {
+        nd = (list_node*)slab_alloc(&l->arena, id);
+        if (nd == NULL) { break; }  // buy more RAM
+      } else {
+        nd = l->freelists[id].head;
+        l->freelists[id].head = nd->next;
+      }
+      nd->read = 0;
+      nd->write = 0;
+      nd->next = NULL;
+      t->next = nd;
+      t = nd;
+    }
+    while (c < n && t->write < UNROLL) {
+      t->values[t->write++] = vs[c++];
+    }
+  }
+  l->tail = t;
+  l->size += c;
+  return c;
+}
+
+// append multiple values to list (including statistics)
+static int list_enq_batch_stats(list *l, int id, const value_t *vs, int n, stats *s) {
+  list_node *t = l->tail;
+  int c = 0;
+  while (c < n) {
+    if (t->write == UNROLL) {
+      list_node *nd;
+      if (l->freelists[id].head == NULL) {
+        nd = (list_node*)slab_alloc_stats(&l->arena, id, s);
+        if (nd == NULL) { break; }  // buy more RAM
+      } else {
+        nd = l->freelists[id].head;
+        l->freelists[id].head = nd->next;
+        s->freelist_len--;
+      }
+      nd->read = 0;
+      nd->write = 0;
+      nd->next = NULL;
+      t->next = nd;
+      t = nd;
+    }
+    while (c < n && t->write < UNROLL) {
+      t->values[t->write++] = vs[c++];
+    }
+  }
+  l->tail = t;
+  l->size += c;
+  return c;
+}
+
+// remove up to max values from list (returns number of removed values)
+static int list_deq_batch(list *l, int id, value_t *vs, int max) {
+  list_node *h = l->head;
+  int c = 0;
+  while (c < max) {
+    if (h->read == h->write) {
+      list_node *new = h->next;
+      if (new == NULL) { break; }
+      h->next = l->freelists[id].head;
+      l->freelists[id].head = h;
+      h = new;
+    }
+    while (c < max && h->read < h->write) {
+      vs[c++] = h->values[h->read++];
+    }
+  }
+  l->head = h;
+  l->size -= c;
+  return c;
+}
+
+// remove up to max values from list (including statistics)
+static int list_deq_batch_stats(list *l, int id, value_t *vs, int max, stats *s) {
+  list_node *h = l->head;
+  int c = 0;
+  while (c < max) {
+    if (h->read == h->write) {
+      list_node *new = h->next;
+      if (new == NULL) { break; }
+      h->next = l->freelists[id].head;
+      l->freelists[id].head = h;
+      h = new;
+      s->freelist_len++;
+      if (s->freelist_len > s->freelist_max) {
+        s->freelist_max = s->freelist_len;
+      }
+      s->freelist_insert++;
+    }
+    while (c < max && h->read < h->write) {
+      vs[c++] = h->values[h->read++];
+    }
+  }
+  l->head = h;
+  l->size -= c;
+  return c;
+}
+
+// length of list (the size kept up to date by every operation, walks the list with LEN_WALK)
+static int list_len(list *l) {
+#if LEN == LEN_WALK
+  list_node *n = l->head;
+  int c = 0;
+  while (n != NULL) {
+    c += n->write - n->read;
+    n = n->next;
+  }
+  return c;
+#else
+  return (int)l->size;
+#endif
+}
+
+// free all nodes of list
+static void list_destroy(list *l) {
+  slab_destroy(&l->arena);
+  free(l->freelists);
+}
+
+#endif
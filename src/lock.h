@@ -0,0 +1,196 @@
+#ifndef LOCK_H
+#define LOCK_H
+
+#include <stdatomic.h>
+#include <sched.h>
+#include "queue.h"
+#include "backoff.h"
+#include <omp.h>
+
+// lock implementations of the lock based variants
+#define LOCK_OMP    0  // omp_lock_t of the OpenMP runtime
+#define LOCK_TAS    1  // test and test and set, truncated exponential backoff after a lost race
+#define LOCK_TICKET 2  // ticket lock (FIFO, every waiter spins on the serving counter)
+#define LOCK_MCS    3  // MCS queue lock (FIFO, every waiter spins on its own node)
+#define LOCK_CLH    4  // CLH queue lock (FIFO, every waiter spins on the node of its predecessor)
+
+// lock of the build (e.g. -DLOCK=LOCK_MCS)
+#ifndef LOCK
+#define LOCK LOCK_OMP
+#endif
+
+// wait bounds of the TAS lock in spins
+#ifndef LOCK_BACKOFF_MIN
+#define LOCK_BACKOFF_MIN 4
+#endif
+#ifndef LOCK_BACKOFF_MAX
+#define LOCK_BACKOFF_MAX 1024
+#endif
+
+// checks of a FIFO lock waiter before it yields its cpu between checks (a preempted successor would otherwise
+// make every handoff wait out a whole time slice on an oversubscribed box)
+#ifndef LOCK_SPINS
+#define LOCK_SPINS 64
+#endif
+
+// wait a little before checking a FIFO lock (or the combiner lock of fc) again (spins counts the checks of the waiter)
+static void lock_pause(int *spins) {
+  if (++*spins < LOCK_SPINS) {
+    backoff_spin(1);
+  } else {
+    sched_yield();
+  }
+}
+
+// node of a queue lock (MCS: one per thread, CLH: one per thread plus one)
+typedef struct lock_node {
+  PADDED _Atomic(struct lock_node*) next;
+  _Atomic(int) locked;
+} lock_node;
+
+// per thread state of the CLH lock (the node it enqueues next and the one it waits on)
+typedef struct lock_thread {
+  PADDED lock_node *mine;
+  lock_node *pred;
+} lock_thread;
+
+// lock definition
+typedef struct lock {
+#if LOCK == LOCK_OMP
+  PADDED omp_lock_t l;
+#elif LOCK == LOCK_TAS
+  PADDED _Atomic(int) held;
+#elif LOCK == LOCK_TICKET
+  PADDED _Atomic(unsigned) next;
+  PADDED _Atomic(unsigned) serving;
+#elif LOCK == LOCK_MCS
+  PADDED _Atomic(lock_node*) tail;
+  lock_node *nodes;
+#elif LOCK == LOCK_CLH
+  PADDED _Atomic(lock_node*) tail;
+  lock_node *nodes;
+  lock_thread *threads;
+#else
+#error "unknown LOCK"
+#endif
+} lock;
+
+// initialize lock for max_threads threads
+static int lock_init(lock *l, int max_threads) {
+#if LOCK == LOCK_OMP
+  omp_init_lock(&l->l);
+#elif LOCK == LOCK_TAS
+  atomic_store(&l->held, 0);
+#elif LOCK == LOCK_TICKET
+  atomic_store(&l->next, 0);
+  atomic_store(&l->serving, 0);
+#elif LOCK == LOCK_MCS
+  l->nodes = (lock_node*)calloc_padded(max_threads, sizeof(lock_node));
+  if (l->nodes == NULL) { return QUEUE_NOMEM; }  // buy more RAM
+  atomic_store(&l->tail, NULL);
+#elif LOCK == LOCK_CLH
+  l->nodes = (lock_node*)calloc_padded(max_threads + 1, sizeof(lock_node));
+  l->threads = (lock_thread*)calloc_padded(max_threads, sizeof(lock_thread));
+  if (l->nodes == NULL || l->threads == NULL) {
+    free(l->nodes);
+    free(l->threads);
+    l->nodes = NULL;
+    l->threads = NULL;
+    return QUEUE_NOMEM;
+  }  // buy more RAM
+  for (int i = 0; i < max_threads; i++) {
+    l->threads[i].mine = &l->nodes[i];
+  }
+  // the spare node starts as the released tail
+  atomic_store(&l->nodes[max_threads].locked, 0);
+  atomic_store(&l->tail, &l->nodes[max_threads]);
+#endif
+  return QUEUE_OK;
+}
+
+// acquire lock (id: thread number)
+static void lock_acquire(lock *l, int id) {
+#if LOCK == LOCK_OMP
+  omp_set_lock(&l->l);
+#elif LOCK == LOCK_TAS
+  int w = LOCK_BACKOFF_MIN;
+  while (1) {
+    while (atomic_load(&l->held)) {
+      backoff_spin(1);
+    }
+    if (atomic_exchange(&l->held, 1) == 0) { return; }
+    backoff_spin(w);
+    w = w * 2 < LOCK_BACKOFF_MAX ? w * 2 : LOCK_BACKOFF_MAX;
+  }
+#elif LOCK == LOCK_TICKET
+  unsigned t = atomic_fetch_add(&l->next, 1);
+  int spins = 0;
+  while (atomic_load(&l->serving) != t) {
+    lock_pause(&spins);
+  }
+#elif LOCK == LOCK_MCS
+  lock_node *n = &l->nodes[id];
+  atomic_store(&n->next, NULL);
+  atomic_store(&n->locked, 1);
+  lock_node *pred = atomic_exchange(&l->tail, n);
+  if (pred == NULL) { return; }
+  atomic_store(&pred->next, n);
+  int spins = 0;
+  while (atomic_load(&n->locked)) {
+    lock_pause(&spins);
+  }
+#elif LOCK == LOCK_CLH
+  lock_thread *t = &l->threads[id];
+  atomic_store(&t->mine->locked, 1);
+  t->pred = atomic_exchange(&l->tail, t->mine);
+  int spins = 0;
+  while (atomic_load(&t->pred->locked)) {
+    lock_pause(&spins);
+  }
+#endif
+}
+
+// release lock (id: thread number, same as on acquire)
+static void lock_release(lock *l, int id) {
+#if LOCK == LOCK_OMP
+  omp_unset_lock(&l->l);
+#elif LOCK == LOCK_TAS
+  atomic_store(&l->held, 0);
+#elif LOCK == LOCK_TICKET
+  // only the holder writes serving
+  atomic_store(&l->serving, atomic_load(&l->serving) + 1);
+#elif LOCK == LOCK_MCS
+  lock_node *n = &l->nodes[id];
+  lock_node *succ = atomic_load(&n->next);
+  if (succ == NULL) {
+    lock_node *expected = n;
+    if (atomic_compare_exchange_strong(&l->tail, &expected, NULL)) { return; }
+    // a successor swapped the tail but did not link itself yet
+    int spins = 0;
+    while ((succ = atomic_load(&n->next)) == NULL) {
+      lock_pause(&spins);
+    }
+  }
+  atomic_store(&succ->locked, 0);
+#elif LOCK == LOCK_CLH
+  // hand our node to the successor, reuse the one of the predecessor
+  lock_thread *t = &l->threads[id];
+  lock_node *n = t->mine;
+  t->mine = t->pred;
+  atomic_store(&n->locked, 0);
+#endif
+}
+
+// destroy lock
+static void lock_destroy(lock *l) {
+#if LOCK == LOCK_OMP
+  omp_destroy_lock(&l->l);
+#elif LOCK == LOCK_MCS
+  free(l->nodes);
+#elif LOCK == LOCK_CLH
+  free(l->nodes);
+  free(l->threads);
+#endif
+}
+
+#endif
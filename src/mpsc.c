@@ -0,0 +1,242 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "queue.h"
+#include "slab.h"
+#include "pool.h"
+#include "wait.h"
+#include "count.h"
+#include <omp.h>
+
+// multi producer, single consumer list (Vyukov): any number of threads may enqueue, only one thread
+// may dequeue at a time. an enqueue is one atomic exchange on head plus a store to link the old head,
+// the dequeuer only follows next pointers from its dummy node.
+// an enqueuer that got preempted between exchange and link hides everything behind it until it links,
+// deq reports QUEUE_EMPTY in the meantime
+
+// node definition
+typedef struct node {
+  value_t value;
+  _Atomic(struct node*) next;
+} node;
+
+// queue definition (enqueuers swap head, the dequeuer owns tail, the dummy node)
+typedef struct queue {
+  PADDED _Atomic(node*) head;
+  PADDED node *tail;
+  pool nodes;
+  slab arena;
+  waiter waiting;
+  counter count;
+  int max_threads;
+} queue;
+
+// get node from the pool, fall back to the slab
+static node *node_new(queue *q, int id) {
+  node *n = (node*)pool_get(&q->nodes, id);
+  return n != NULL ? n : (node*)slab_alloc(&q->arena, id);
+}
+
+// get node from the pool, fall back to the slab (including statistics)
+static node *node_new_stats(queue *q, int id, stats *s) {
+  node *n = (node*)pool_get_stats(&q->nodes, id, s);
+  return n != NULL ? n : (node*)slab_alloc_stats(&q->arena, id, s);
+}
+
+// append chain first..last with a single exchange
+static void push(queue *q, node *first, node *last) {
+  node *prev = atomic_exchange(&q->head, last);
+  atomic_store(&prev->next, first);
+}
+
+// create queue
+queue* create() {
+  queue *q = (queue*)calloc_padded(1, sizeof(queue));
+  if (!q) { return NULL; }  // buy more RAM
+  return q;
+}
+
+// initialize queue
+int init(queue *q) {
+  q->max_threads = omp_get_max_threads();
+  int ret_pool = pool_init(&q->nodes, q->max_threads, &q->arena);
+  int ret_slab = slab_init(&q->arena, sizeof(node), q->max_threads);
+  int ret_count = count_init(&q->count, q->max_threads);
+  if (ret_pool != QUEUE_OK || ret_slab != QUEUE_OK || ret_count != QUEUE_OK) {
+    pool_destroy(&q->nodes);
+    slab_destroy(&q->arena);
+    count_destroy(&q->count);
+    return QUEUE_NOMEM;
+  }  // buy more RAM
+  node *n = node_new(q, omp_get_thread_num());
+  if (n == NULL) {
+    pool_destroy(&q->nodes);
+    slab_destroy(&q->arena);
+    count_destroy(&q->count);
+    return QUEUE_NOMEM;
+  }  // buy more RAM
+  atomic_store(&n->next, NULL);
+  atomic_store(&q->head, n);
+  q->tail = n;
+  wait_init(&q->waiting);
+  return QUEUE_OK;
+}
+
+// enqueue in queue
+int enq(value_t v, queue *q) {
+  int id = omp_get_thread_num();
+  node *n = node_new(q, id);
+  if (n == NULL) { return QUEUE_NOMEM; }  // buy more RAM
+  n->value = v;
+  atomic_store(&n->next, NULL);
+  push(q, n, n);
+  count_enq(&q->count, id, 1);
+  wait_wake(&q->waiting, 1);
+  return QUEUE_OK;
+}
+
+// enqueue in queue (including statistics)
+int enq_stats(value_t v, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  node *n = node_new_stats(q, id, s);
+  if (n == NULL) { return QUEUE_NOMEM; }  // buy more RAM
+  n->value = v;
+  atomic_store(&n->next, NULL);
+  push(q, n, n);
+  count_enq(&q->count, id, 1);
+  wait_wake_stats(&q->waiting, 1, s);
+  return QUEUE_OK;
+}
+
+// dequeue from queue
+int deq(value_t *v, queue *q) {
+  int id = omp_get_thread_num();
+  node *tail = q->tail;
+  node *next = atomic_load(&tail->next);
+  if (next == NULL) { return QUEUE_EMPTY; }
+  *v = next->value;
+  q->tail = next;
+  pool_put(&q->nodes, id, tail);
+  count_deq(&q->count, id, 1);
+  return QUEUE_OK;
+}
+
+// dequeue from queue (including statistics)
+int deq_stats(value_t *v, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  node *tail = q->tail;
+  node *next = atomic_load(&tail->next);
+  if (next == NULL) { return QUEUE_EMPTY; }
+  *v = next->value;
+  q->tail = next;
+  pool_put_stats(&q->nodes, id, tail, s);
+  count_deq(&q->count, id, 1);
+  return QUEUE_OK;
+}
+
+// enqueue multiple values in queue (returns number of enqueued values)
+int enq_batch(const value_t *vs, int n, queue *q) {
+  int id = omp_get_thread_num();
+  node *first = NULL;
+  node *last = NULL;
+  int c = 0;
+  for (; c < n; c++) {
+    node *nd = node_new(q, id);
+    if (nd == NULL) { break; }  // buy more RAM
+    nd->value = vs[c];
+    atomic_store(&nd->next, NULL);
+    if (last == NULL) { first = nd; } else { atomic_store(&last->next, nd); }
+    last = nd;
+  }
+  if (c == 0) { return 0; }
+  push(q, first, last);
+  count_enq(&q->count, id, c);
+  wait_wake(&q->waiting, c);
+  return c;
+}
+
+// enqueue multiple values in queue (including statistics)
+int enq_batch_stats(const value_t *vs, int n, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  node *first = NULL;
+  node *last = NULL;
+  int c = 0;
+  for (; c < n; c++) {
+    node *nd = node_new_stats(q, id, s);
+    if (nd == NULL) { break; }  // buy more RAM
+    nd->value = vs[c];
+    atomic_store(&nd->next, NULL);
+    if (last == NULL) { first = nd; } else { atomic_store(&last->next, nd); }
+    last = nd;
+  }
+  if (c == 0) { return 0; }
+  push(q, first, last);
+  count_enq(&q->count, id, c);
+  wait_wake_stats(&q->waiting, c, s);
+  return c;
+}
+
+// dequeue up to max values from queue (returns number of dequeued values)
+int deq_batch(value_t *vs, int max, queue *q) {
+  int id = omp_get_thread_num();
+  int c = 0;
+  while (c < max) {
+    node *tail = q->tail;
+    node *next = atomic_load(&tail->next);
+    if (next == NULL) { break; }
+    vs[c++] = next->value;
+    q->tail = next;
+    pool_put(&q->nodes, id, tail);
+  }
+  count_deq(&q->count, id, c);
+  return c;
+}
+
+// dequeue up to max values from queue (including statistics)
+int deq_batch_stats(value_t *vs, int max, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  int c = 0;
+  while (c < max) {
+    node *tail = q->tail;
+    node *next = atomic_load(&tail->next);
+    if (next == NULL) { break; }
+    vs[c++] = next->value;
+    q->tail = next;
+    pool_put_stats(&q->nodes, id, tail, s);
+  }
+  count_deq(&q->count, id, c);
+  return c;
+}
+
+// dequeue from queue, sleep while it is empty (at most timeout seconds, forever if timeout < 0)
+int deq_wait(value_t *v, queue *q, double timeout) {
+  return wait_deq(&q->waiting, deq, v, q, timeout);
+}
+
+// dequeue from queue, sleep while it is empty (including statistics)
+int deq_wait_stats(value_t *v, queue *q, double timeout, stats *s) {
+  return wait_deq_stats(&q->waiting, deq_stats, v, q, timeout, s);
+}
+
+// length of queue
+int len(queue *q) {
+#if LEN == LEN_WALK
+  node *n = atomic_load(&q->tail->next);
+  int c = 0;
+  while (n != NULL) {
+    c++;
+    n = atomic_load(&n->next);
+  }
+  return c;
+#else
+  return count_len(&q->count);
+#endif
+}
+
+// destroy queue
+void destroy(queue *q) {
+  pool_destroy(&q->nodes);
+  slab_destroy(&q->arena);
+  count_destroy(&q->count);
+  free(q);
+}
@@ -0,0 +1,468 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include "queue.h"
+#include "slab.h"
+#include "pool.h"
+#include "wait.h"
+#include "cohort.h"
+#include "count.h"
+#include "place.h"
+#include <omp.h>
+
+// numa aware two lock queue (conc2 with a cohort lock per end and node local memory):
+// nodes come from the slab of the allocating thread, so their pages get first touched on its numa node,
+// and go back to the pool of that node when they are dequeued, wherever the dequeuer runs.
+// a thread only takes nodes from the pool of its own node, so memory never wanders between sockets.
+// the numa node of a thread is looked up once (sched_getcpu), so pin the threads (bench -p)
+
+// simulated topology (e.g. -DNUMA_SIM=2): threads are split into NUMA_SIM contiguous blocks,
+// as if they were placed compact on that many sockets; lets the cohort handoffs run on a single node box
+#ifdef NUMA_SIM
+_Static_assert(NUMA_SIM > 0, "NUMA_SIM has to be positive");
+#endif
+
+// node definition (unrolled, values[read..write) are still in the queue; enqueuers publish write)
+typedef struct node {
+  int read;
+  _Atomic(int) write;
+  struct node *next;
+  int home;  // numa node it got allocated on
+  value_t values[UNROLL];
+} node;
+
+// per thread state (spare node fetched outside the lock, numa node the thread runs on, -1 if not looked up yet)
+typedef struct numa_thread {
+  PADDED node *spare;
+  int node;
+} numa_thread;
+
+// queue definition
+typedef struct queue {
+  PADDED node *head;
+  PADDED node *tail;
+  cohort lock_enq;
+  cohort lock_deq;
+  pool *pools;  // one per numa node
+  slab arena;
+  numa_thread *threads;
+  waiter waiting;
+  counter count;
+  int nodes;
+  int max_threads;
+} queue;
+
+// create queue
+queue* create() {
+  queue *q = (queue*)calloc_padded(1, sizeof(queue));
+  if (!q) { return NULL; }  // buy more RAM
+  return q;
+}
+
+// free everything init allocated (parts that were not allocated are NULL)
+static void release(queue *q) {
+  for (int i = 0; q->pools != NULL && i < q->nodes; i++) {
+    pool_destroy(&q->pools[i]);
+  }
+  free(q->pools);
+  slab_destroy(&q->arena);
+  free(q->threads);
+  cohort_destroy(&q->lock_enq);
+  cohort_destroy(&q->lock_deq);
+  count_destroy(&q->count);
+}
+
+// numa node of thread id
+static int node_of(queue *q, int id) {
+#ifdef NUMA_SIM
+  return id * q->nodes / q->max_threads;
+#else
+  numa_thread *t = &q->threads[id];
+  if (t->node < 0) {
+    int cpu = sched_getcpu();
+    int n = cpu < 0 ? 0 : place_node(cpu);
+    t->node = n < q->nodes ? n : 0;
+  }
+  return t->node;
+#endif
+}
+
+// initialize queue
+int init(queue *q) {
+  q->max_threads = omp_get_max_threads();
+#ifdef NUMA_SIM
+  q->nodes = NUMA_SIM;
+#else
+  q->nodes = place_nodes();
+#endif
+  // nodes belong to the slab, the pools only recycle them: a surplus would go to the slab of the thread handing it
+  // back, which may run on another node than the pool, so the pools keep everything (no high water)
+  q->pools = (pool*)calloc(q->nodes, sizeof(pool));
+  int ret_pool = q->pools == NULL ? QUEUE_NOMEM : QUEUE_OK;
+  for (int i = 0; q->pools != NULL && i < q->nodes; i++) {
+    if (pool_init(&q->pools[i], q->max_threads, &q->arena) != QUEUE_OK) { ret_pool = QUEUE_NOMEM; }
+    q->pools[i].high_water = LONG_MAX;
+  }
+  int ret_slab = slab_init(&q->arena, sizeof(node), q->max_threads);
+  q->threads = (numa_thread*)calloc_padded(q->max_threads, sizeof(numa_thread));
+  int ret_enq = cohort_init(&q->lock_enq, q->nodes);
+  int ret_deq = cohort_init(&q->lock_deq, q->nodes);
+  int ret_count = count_init(&q->count, q->max_threads);
+  if (ret_pool != QUEUE_OK || ret_slab != QUEUE_OK || q->threads == NULL || ret_enq != QUEUE_OK || ret_deq != QUEUE_OK ||
+      ret_count != QUEUE_OK) {
+    release(q);
+    return QUEUE_NOMEM;
+  }  // buy more RAM
+  for (int i = 0; i < q->max_threads; i++) {
+    q->threads[i].node = -1;
+  }
+  int id = omp_get_thread_num();
+  node *n = (node*)slab_alloc(&q->arena, id);
+  if (n == NULL) {
+    release(q);
+    return QUEUE_NOMEM;
+  }  // buy more RAM
+  n->read = 0;
+  atomic_store(&n->write, 0);
+  n->next = NULL;
+  n->home = node_of(q, id);
+  q->head = n;
+  q->tail = n;
+  wait_init(&q->waiting);
+  return QUEUE_OK;
+}
+
+// get empty node from the pool of the numa node of the thread or its slab (NULL if out of memory)
+static node *node_get(queue *q, int id, int home) {
+  node *n = (node*)pool_get(&q->pools[home], id);
+  if (n == NULL) {
+    n = (node*)slab_alloc(&q->arena, id);
+    if (n == NULL) { return NULL; }  // buy more RAM
+    n->home = home;
+  }
+  n->read = 0;
+  atomic_store(&n->write, 0);
+  n->next = NULL;
+  return n;
+}
+
+// get empty node from the pool of the numa node of the thread or its slab (including statistics)
+static node *node_get_stats(queue *q, int id, int home, stats *s) {
+  node *n = (node*)pool_get_stats(&q->pools[home], id, s);
+  if (n == NULL) {
+    n = (node*)slab_alloc_stats(&q->arena, id, s);
+    if (n == NULL) { return NULL; }  // buy more RAM
+    n->home = home;
+  }
+  n->read = 0;
+  atomic_store(&n->write, 0);
+  n->next = NULL;
+  return n;
+}
+
+// hand node back to the pool of the numa node it got allocated on
+static void node_put(queue *q, int id, node *n) {
+  pool_put(&q->pools[n->home], id, n);
+}
+
+// hand node back to the pool of the numa node it got allocated on (including statistics)
+static void node_put_stats(queue *q, int id, int home, node *n, stats *s) {
+  if (n->home != home) { s->numa_remote++; }
+  pool_put_stats(&q->pools[n->home], id, n, s);
+}
+
+// enqueue in queue
+int enq(value_t v, queue *q) {
+  int id = omp_get_thread_num();
+  int home = node_of(q, id);
+  node *n = q->threads[id].spare;
+  if (n == NULL) {
+    n = node_get(q, id, home);
+    q->threads[id].spare = n;
+  }
+  cohort_acquire(&q->lock_enq, home);
+  node *t = q->tail;
+  int w = atomic_load(&t->write);
+  if (w < UNROLL) {
+    t->values[w] = v;
+    atomic_store(&t->write, w + 1);
+  } else if (n != NULL) {
+    n->values[0] = v;
+    atomic_store(&n->write, 1);
+    t->next = n;
+    q->tail = n;
+    q->threads[id].spare = NULL;
+  } else {
+    cohort_release(&q->lock_enq, home);
+    return QUEUE_NOMEM;  // buy more RAM
+  }
+  cohort_release(&q->lock_enq, home);
+  count_enq(&q->count, id, 1);
+  wait_wake(&q->waiting, 1);
+  return QUEUE_OK;
+}
+
+// enqueue in queue (including statistics)
+int enq_stats(value_t v, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  int home = node_of(q, id);
+  node *n = q->threads[id].spare;
+  if (n == NULL) {
+    n = node_get_stats(q, id, home, s);
+    q->threads[id].spare = n;
+  }
+  cohort_acquire_stats(&q->lock_enq, home, s);
+  node *t = q->tail;
+  int w = atomic_load(&t->write);
+  if (w < UNROLL) {
+    t->values[w] = v;
+    atomic_store(&t->write, w + 1);
+  } else if (n != NULL) {
+    n->values[0] = v;
+    atomic_store(&n->write, 1);
+    t->next = n;
+    q->tail = n;
+    q->threads[id].spare = NULL;
+  } else {
+    cohort_release(&q->lock_enq, home);
+    return QUEUE_NOMEM;  // buy more RAM
+  }
+  cohort_release(&q->lock_enq, home);
+  count_enq(&q->count, id, 1);
+  wait_wake_stats(&q->waiting, 1, s);
+  return QUEUE_OK;
+}
+
+// dequeue from queue
+int deq(value_t *v, queue *q) {
+  int id = omp_get_thread_num();
+  int home = node_of(q, id);
+  cohort_acquire(&q->lock_deq, home);
+  node *old = q->head;
+  node *h = old;
+  if (h->read == atomic_load(&h->write)) {
+    node *new = h->next;
+    if (new == NULL) {
+      cohort_release(&q->lock_deq, home);
+      return QUEUE_EMPTY;
+    }
+    // node may have been filled up (or closed by a batch) before new got linked
+    if (h->read == atomic_load(&h->write)) {
+      h = new;
+      q->head = h;
+    }
+  }
+  *v = h->values[h->read++];
+  cohort_release(&q->lock_deq, home);
+  count_deq(&q->count, id, 1);
+  if (h != old) { node_put(q, id, old); }
+  return QUEUE_OK;
+}
+
+// dequeue from queue (including statistics)
+int deq_stats(value_t *v, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  int home = node_of(q, id);
+  cohort_acquire_stats(&q->lock_deq, home, s);
+  node *old = q->head;
+  node *h = old;
+  if (h->read == atomic_load(&h->write)) {
+    node *new = h->next;
+    if (new == NULL) {
+      cohort_release(&q->lock_deq, home);
+      return QUEUE_EMPTY;
+    }
+    // node may have been filled up (or closed by a batch) before new got linked
+    if (h->read == atomic_load(&h->write)) {
+      h = new;
+      q->head = h;
+    }
+  }
+  *v = h->values[h->read++];
+  cohort_release(&q->lock_deq, home);
+  count_deq(&q->count, id, 1);
+  if (h != old) { node_put_stats(q, id, home, old, s); }
+  return QUEUE_OK;
+}
+
+// enqueue multiple values in queue (returns number of enqueued values)
+int enq_batch(const value_t *vs, int n, queue *q) {
+  if (n <= 0) { return 0; }
+  int id = omp_get_thread_num();
+  int home = node_of(q, id);
+  // reserve enough nodes outside the lock, unused ones go back to the pool
+  node *rest = NULL;
+  for (int k = 0; k < (n + UNROLL - 1) / UNROLL; k++) {
+    node *nd = node_get(q, id, home);
+    if (nd == NULL) { break; }  // buy more RAM
+    nd->next = rest;
+    rest = nd;
+  }
+  cohort_acquire(&q->lock_enq, home);
+  node *t = q->tail;
+  int w = atomic_load(&t->write);
+  int c = 0;
+  while (c < n && w < UNROLL) {
+    t->values[w++] = vs[c++];
+  }
+  atomic_store(&t->write, w);
+  while (c < n && rest != NULL) {
+    node *nd = rest;
+    rest = nd->next;
+    nd->next = NULL;
+    for (w = 0; c < n && w < UNROLL; w++) {
+      nd->values[w] = vs[c++];
+    }
+    atomic_store(&nd->write, w);
+    t->next = nd;
+    t = nd;
+  }
+  q->tail = t;
+  cohort_release(&q->lock_enq, home);
+  count_enq(&q->count, id, c);
+  while (rest != NULL) {
+    node *next = rest->next;
+    node_put(q, id, rest);
+    rest = next;
+  }
+  wait_wake(&q->waiting, c);
+  return c;
+}
+
+// enqueue multiple values in queue (including statistics)
+int enq_batch_stats(const value_t *vs, int n, queue *q, stats *s) {
+  if (n <= 0) { return 0; }
+  int id = omp_get_thread_num();
+  int home = node_of(q, id);
+  // reserve enough nodes outside the lock, unused ones go back to the pool
+  node *rest = NULL;
+  for (int k = 0; k < (n + UNROLL - 1) / UNROLL; k++) {
+    node *nd = node_get_stats(q, id, home, s);
+    if (nd == NULL) { break; }  // buy more RAM
+    nd->next = rest;
+    rest = nd;
+  }
+  cohort_acquire_stats(&q->lock_enq, home, s);
+  node *t = q->tail;
+  int w = atomic_load(&t->write);
+  int c = 0;
+  while (c < n && w < UNROLL) {
+    t->values[w++] = vs[c++];
+  }
+  atomic_store(&t->write, w);
+  while (c < n && rest != NULL) {
+    node *nd = rest;
+    rest = nd->next;
+    nd->next = NULL;
+    for (w = 0; c < n && w < UNROLL; w++) {
+      nd->values[w] = vs[c++];
+    }
+    atomic_store(&nd->write, w);
+    t->next = nd;
+    t = nd;
+  }
+  q->tail = t;
+  cohort_release(&q->lock_enq, home);
+  count_enq(&q->count, id, c);
+  while (rest != NULL) {
+    node *next = rest->next;
+    node_put_stats(q, id, home, rest, s);
+    rest = next;
+  }
+  wait_wake_stats(&q->waiting, c, s);
+  return c;
+}
+
+// dequeue up to max values from queue (returns number of dequeued values)
+int deq_batch(value_t *vs, int max, queue *q) {
+  int id = omp_get_thread_num();
+  int home = node_of(q, id);
+  cohort_acquire(&q->lock_deq, home);
+  node *old = q->head;
+  node *h = old;
+  int c = 0;
+  while (c < max) {
+    int w = atomic_load(&h->write);
+    if (h->read == w) {
+      node *new = h->next;
+      if (new == NULL) { break; }
+      if (h->read == atomic_load(&h->write)) { h = new; }
+      continue;
+    }
+    while (c < max && h->read < w) {
+      vs[c++] = h->values[h->read++];
+    }
+  }
+  q->head = h;
+  cohort_release(&q->lock_deq, home);
+  count_deq(&q->count, id, c);
+  while (old != h) {
+    node *next = old->next;
+    node_put(q, id, old);
+    old = next;
+  }
+  return c;
+}
+
+// dequeue up to max values from queue (including statistics)
+int deq_batch_stats(value_t *vs, int max, queue *q, stats *s) {
+  int id = omp_get_thread_num();
+  int home = node_of(q, id);
+  cohort_acquire_stats(&q->lock_deq, home, s);
+  node *old = q->head;
+  node *h = old;
+  int c = 0;
+  while (c < max) {
+    int w = atomic_load(&h->write);
+    if (h->read == w) {
+      node *new = h->next;
+      if (new == NULL) { break; }
+      if (h->read == atomic_load(&h->write)) { h = new; }
+      continue;
+    }
+    while (c < max && h->read < w) {
+      vs[c++] = h->values[h->read++];
+    }
+  }
+  q->head = h;
+  cohort_release(&q->lock_deq, home);
+  count_deq(&q->count, id, c);
+  while (old != h) {
+    node *next = old->next;
+    node_put_stats(q, id, home, old, s);
+    old = next;
+  }
+  return c;
+}
+
+// dequeue from queue, sleep while it is empty (at most timeout seconds, forever if timeout < 0)
+int deq_wait(value_t *v, queue *q, double timeout) {
+  return wait_deq(&q->waiting, deq, v, q, timeout);
+}
+
+// dequeue from queue, sleep while it is empty (including statistics)
+int deq_wait_stats(value_t *v, queue *q, double timeout, stats *s) {
+  return wait_deq_stats(&q->waiting, deq_stats, v, q, timeout, s);
+}
+
+// length of queue
+int len(queue *q) {
+#if LEN == LEN_WALK
+  node *n = q->head;
+  int c = 0;
+  while (n != NULL) {
+    c += atomic_load(&n->write) - n->read;
+    n = n->next;
+  }
+  return c;
+#else
+  return count_len(&q->count);
+#endif
+}
+
+// destroy queue
+void destroy(queue *q) {
+  release(q);
+  free(q);
+}
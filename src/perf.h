@@ -0,0 +1,108 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// per thread counters of the kernel (perf_event_open) for the calling thread (hardware ones in user space only).
+// hardware events that can not be opened (no PMU, containers, perf_event_paranoid) are left out,
+// the software events are counted anyway, so there is always something to fall back to
+
+// cache event config (cache, operation, result)
+#define PERF_CACHE(c, op, res) ((c) | ((op) << 8) | ((res) << 16))
+
+// event definition
+typedef struct perf_def {
+  const char *name;
+  unsigned int type;
+  unsigned long long config;
+} perf_def;
+
+// counted events (cache line transfers between cores have no generic event, node misses show the ones between sockets)
+static const perf_def perf_defs[] = {
+  { "cycles",           PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { "instructions",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { "l1d_misses",       PERF_TYPE_HW_CACHE, PERF_CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+  { "llc_misses",       PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { "node_misses",      PERF_TYPE_HW_CACHE, PERF_CACHE(PERF_COUNT_HW_CACHE_NODE, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+  { "task_clock_ns",    PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+  { "context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+  { "cpu_migrations",   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS },
+  { "page_faults",      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+#define PERF_EVENTS ((int)(sizeof(perf_defs) / sizeof(perf_defs[0])))
+
+// open counters of a thread (fd -1 if not counted)
+typedef struct perf {
+  int fd[PERF_EVENTS];
+} perf;
+
+// open and start every available counter for the calling thread (nothing if on is 0)
+static void perf_start(perf *p, int on) {
+  for (int i = 0; i < PERF_EVENTS; i++) {
+    p->fd[i] = -1;
+    if (!on) { continue; }
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = perf_defs[i].type;
+    attr.config = perf_defs[i].config;
+    attr.disabled = 1;
+    // software events (e.g. context switches) happen in the kernel
+    attr.exclude_kernel = perf_defs[i].type != PERF_TYPE_SOFTWARE;
+    attr.exclude_hv = 1;
+    // more events than hardware counters get multiplexed, the running time scales them back
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    p->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+  for (int i = 0; i < PERF_EVENTS; i++) {
+    if (p->fd[i] >= 0) {
+      ioctl(p->fd[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(p->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+}
+
+// stop and close the counters, add their (scaled) values to counts and set the bits of the counted events in mask
+static void perf_stop(perf *p, long *counts, long *mask) {
+  for (int i = 0; i < PERF_EVENTS; i++) {
+    if (p->fd[i] >= 0) {
+      ioctl(p->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+  }
+  for (int i = 0; i < PERF_EVENTS; i++) {
+    if (p->fd[i] < 0) { continue; }
+    unsigned long long v[3];  // value, time enabled, time running
+    if (read(p->fd[i], v, sizeof(v)) == sizeof(v) && v[2] > 0) {
+      counts[i] += (long)(v[2] < v[1] ? (double)v[0] * v[1] / v[2] : v[0]);
+      *mask |= 1L << i;
+    }
+    close(p->fd[i]);
+    p->fd[i] = -1;
+  }
+}
+
+// print counted events (nothing if none got counted)
+static void perf_print(const long *counts, long mask) {
+  for (int i = 0; i < PERF_EVENTS; i++) {
+    if (mask & (1L << i)) {
+      printf(" perf_%s: %ld\n", perf_defs[i].name, counts[i]);
+    }
+  }
+}
+
+// counted events as json fields (see json_stats in queue.h)
+static void perf_json(FILE *f, const long *counts, long mask) {
+  for (int i = 0; i < PERF_EVENTS; i++) {
+    if (mask & (1L << i)) {
+      fprintf(f, ", \"perf_%s\": %ld", perf_defs[i].name, counts[i]);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,212 @@
+#ifndef PLACE_H
+#define PLACE_H
+
+// needs _GNU_SOURCE (cpu_set_t, sched_setaffinity, sched_getcpu) defined before the first system include
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+// thread placement policies (thread i runs on cpu i of the order, wrapping around if there are more threads)
+#define PLACE_NONE    0  // leave placement to the os
+#define PLACE_COMPACT 1  // fill the cores of one socket before the next one, smt siblings after all cores
+#define PLACE_SCATTER 2  // round robin over the sockets, smt siblings after all cores
+#define PLACE_SMT     3  // smt siblings of a core first, then the next core of the same socket
+#define PLACE_LIST    4  // explicit list of cpus
+
+static const char *place_names[] = { "none", "compact", "scatter", "smt", "list" };
+
+// topology of a cpu (from /sys/devices/system/cpu)
+typedef struct place_cpu {
+  int cpu;
+  int package;
+  int core;
+  int node;
+  int smt;   // index among the smt siblings of its core
+  int rank;  // index of its core within its package
+} place_cpu;
+
+// read one integer from a sysfs file of cpu (-1 if unavailable)
+static int place_read(int cpu, const char *file) {
+  char path[128];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, file);
+  FILE *f = fopen(path, "r");
+  if (f == NULL) { return -1; }
+  int v = -1;
+  if (fscanf(f, "%d", &v) != 1) { v = -1; }
+  fclose(f);
+  return v;
+}
+
+// numa node of cpu (the nodeN entry in its sysfs directory, 0 if there is none)
+static int place_node(int cpu) {
+  char path[128];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  DIR *d = opendir(path);
+  if (d == NULL) { return 0; }
+  int node = 0;
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    if (strncmp(e->d_name, "node", 4) == 0 && e->d_name[4] >= '0' && e->d_name[4] <= '9') {
+      node = atoi(e->d_name + 4);
+      break;
+    }
+  }
+  closedir(d);
+  return node;
+}
+
+// number of numa nodes (highest nodeN in /sys/devices/system/node plus one, 1 if there is none)
+static int place_nodes() {
+  DIR *d = opendir("/sys/devices/system/node");
+  if (d == NULL) { return 1; }
+  int nodes = 1;
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    if (strncmp(e->d_name, "node", 4) == 0 && e->d_name[4] >= '0' && e->d_name[4] <= '9') {
+      int n = atoi(e->d_name + 4) + 1;
+      if (n > nodes) { nodes = n; }
+    }
+  }
+  closedir(d);
+  return nodes;
+}
+
+// topology of the cpus this process may run on (returns their number, *out has to be freed)
+static int place_topology(place_cpu **out) {
+  cpu_set_t set;
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) { return 0; }
+  place_cpu *cs = (place_cpu*)calloc(CPU_SETSIZE, sizeof(place_cpu));
+  if (cs == NULL) { return 0; }  // buy more RAM
+  int n = 0;
+  for (int c = 0; c < CPU_SETSIZE; c++) {
+    if (!CPU_ISSET(c, &set)) { continue; }
+    place_cpu *p = &cs[n++];
+    p->cpu = c;
+    p->package = place_read(c, "topology/physical_package_id");
+    p->core = place_read(c, "topology/core_id");
+    p->node = place_node(c);
+    if (p->package < 0) { p->package = 0; }
+    if (p->core < 0) { p->core = c; }
+  }
+  // smt index and core rank from the cpus seen before (cpus come in ascending order)
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < i; j++) {
+      if (cs[j].package != cs[i].package) { continue; }
+      if (cs[j].core == cs[i].core) {
+        cs[i].smt++;
+      } else if (cs[j].smt == 0) {
+        cs[i].rank++;
+      }
+    }
+    // siblings share the rank of their first cpu
+    for (int j = 0; j < i; j++) {
+      if (cs[j].package == cs[i].package && cs[j].core == cs[i].core && cs[j].smt == 0) {
+        cs[i].rank = cs[j].rank;
+        break;
+      }
+    }
+  }
+  *out = cs;
+  return n;
+}
+
+// sort keys of a policy, most significant first
+static void place_keys(int policy, const place_cpu *c, int k[3]) {
+  switch (policy) {
+    case PLACE_COMPACT: k[0] = c->smt; k[1] = c->package; k[2] = c->rank; break;
+    case PLACE_SCATTER: k[0] = c->smt; k[1] = c->rank; k[2] = c->package; break;
+    default:            k[0] = c->package; k[1] = c->rank; k[2] = c->smt; break;
+  }
+}
+
+// whether a comes before b in the order of policy
+static int place_before(int policy, const place_cpu *a, const place_cpu *b) {
+  int ka[3], kb[3];
+  place_keys(policy, a, ka);
+  place_keys(policy, b, kb);
+  for (int i = 0; i < 3; i++) {
+    if (ka[i] != kb[i]) { return ka[i] < kb[i]; }
+  }
+  return a->cpu < b->cpu;
+}
+
+// parse cpu list like "0,2,8-11" into cpus (returns number of cpus, -1 on a syntax error)
+static int place_parse_list(const char *list, int *cpus, int max) {
+  int n = 0;
+  const char *s = list;
+  while (*s != '\0') {
+    char *end;
+    long from = strtol(s, &end, 10);
+    if (end == s || from < 0) { return -1; }
+    long to = from;
+    s = end;
+    if (*s == '-') {
+      s++;
+      to = strtol(s, &end, 10);
+      if (end == s || to < from) { return -1; }
+      s = end;
+    }
+    for (long c = from; c <= to; c++) {
+      if (n == max) { return -1; }
+      cpus[n++] = (int)c;
+    }
+    if (*s == ',') {
+      s++;
+    } else if (*s != '\0') {
+      return -1;
+    }
+  }
+  return n;
+}
+
+// parse placement argument (policy name or cpu list), returns policy or -1
+static int place_parse(const char *arg) {
+  for (int p = PLACE_NONE; p < PLACE_LIST; p++) {
+    if (strcmp(arg, place_names[p]) == 0) { return p; }
+  }
+  int cpus[CPU_SETSIZE];
+  return place_parse_list(arg, cpus, CPU_SETSIZE) > 0 ? PLACE_LIST : -1;
+}
+
+// cpu of every thread (list is the argument of PLACE_LIST), returns 0 on success
+static int place_plan(int policy, const char *list, int *cpus, int threads) {
+  if (policy == PLACE_LIST) {
+    int order[CPU_SETSIZE];
+    int n = place_parse_list(list, order, CPU_SETSIZE);
+    if (n <= 0) { return 1; }
+    for (int i = 0; i < threads; i++) {
+      cpus[i] = order[i % n];
+    }
+    return 0;
+  }
+  place_cpu *cs;
+  int n = place_topology(&cs);
+  if (n == 0) { return 1; }
+  // insertion sort, there are not that many cpus
+  for (int i = 1; i < n; i++) {
+    place_cpu c = cs[i];
+    int j = i;
+    while (j > 0 && place_before(policy, &c, &cs[j - 1])) {
+      cs[j] = cs[j - 1];
+      j--;
+    }
+    cs[j] = c;
+  }
+  for (int i = 0; i < threads; i++) {
+    cpus[i] = cs[i % n].cpu;
+  }
+  free(cs);
+  return 0;
+}
+
+// pin the calling thread to cpu, returns 0 on success
+static int place_pin(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set);
+}
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "queue.h"
+#include "stamp.h"
+#include "slab.h"
+
+// spare nodes cycle through two magazines per thread, full magazines are exchanged through a shared depot.
+// past the high water the depot hands nodes back to their owner: to the heap, or to the slab they were carved from.
+// a slab never returns its chunks, so with slab nodes memory stays bounded by the peak queue length,
+// the high water only bounds how many spare nodes the threads share
+
+// number of nodes per magazine
+#ifndef POOL_MAG_SIZE
+#define POOL_MAG_SIZE 64
+#endif
+
+// full magazines per thread the depot keeps before surplus nodes go back to their owner
+#ifndef POOL_HIGH_WATER
+#define POOL_HIGH_WATER 64
+#endif
+
+// magazine definition (fixed size stack of spare nodes)
+typedef struct pool_mag {
+  struct pool_mag *next;
+  int count;
+  void *items[POOL_MAG_SIZE];
+} pool_mag;
+
+// per thread part of the pool (only touched by its owner)
+typedef struct pool_local {
+  PADDED pool_mag *loaded;
+  pool_mag *spare;
+} pool_local;
+
+// pool definition (thread local magazines in front of a shared lock-free depot)
+typedef struct pool {
+  pool_local *locals;
+  PADDED asptr full;
+  PADDED asptr empty;
+  PADDED _Atomic(long) full_count;
+  PADDED long high_water;
+  slab *owner;  // slab the nodes are carved from, NULL if they are heap allocated and owned by the pool
+  int max_threads;
+} pool;
+
+// get magazine from stamped magazine
+static pool_mag *get_mag(sptr sm) {
+  return (pool_mag*)get_ptr(sm);
+}
+
+// push magazine onto depot stack
+static void depot_push(asptr *top, pool_mag *m) {
+  sptr old = sptr_load(top);
+  do {
+    m->next = get_mag(old);
+  } while (!sptr_cas(top, &old, stamp(m, get_stamp(old) + 1)));
+}
+
+// pop magazine from depot stack (magazines are never freed while the pool lives)
+static pool_mag *depot_pop(asptr *top) {
+  sptr old = sptr_load(top);
+  while (get_mag(old) != NULL) {
+    pool_mag *m = get_mag(old);
+    if (sptr_cas(top, &old, stamp(m->next, get_stamp(old) + 1))) {
+      return m;
+    }
+  }
+  return NULL;
+}
+
+// get an empty magazine from the depot or allocate one
+static pool_mag *mag_empty(pool *p) {
+  pool_mag *m = depot_pop(&p->empty);
+  if (m == NULL) {
+    m = (pool_mag*)malloc(sizeof(pool_mag));
+    if (m == NULL) { return NULL; }  // buy more RAM
+  }
+  m->count = 0;
+  return m;
+}
+
+// initialize pool; owner is the slab of the nodes, NULL if the pool owns heap allocated nodes (leftovers get freed)
+static int pool_init(pool *p, int max_threads, slab *owner) {
+  p->max_threads = max_threads;
+  p->owner = owner;
+  p->high_water = (long)POOL_HIGH_WATER * max_threads;
+  sptr_store(&p->full, stamp(NULL, 0));
+  sptr_store(&p->empty, stamp(NULL, 0));
+  atomic_store(&p->full_count, 0);
+  p->locals = (pool_local*)calloc_padded(max_threads, sizeof(pool_local));
+  if (p->locals == NULL) { return QUEUE_NOMEM; }  // buy more RAM
+  for (int i = 0; i < max_threads; i++) {
+    p->locals[i].loaded = mag_empty(p);
+    p->locals[i].spare = mag_empty(p);
+    if (p->locals[i].loaded == NULL || p->locals[i].spare == NULL) { return QUEUE_NOMEM; }  // buy more RAM
+  }
+  return QUEUE_OK;
+}
+
+// hand node of thread id back to its owner
+static void pool_drop(pool *p, int id, void *n) {
+  if (p->owner != NULL) {
+    slab_free(p->owner, id, n);
+  } else {
+    free(n);
+  }
+}
+
+// refill loaded magazine of thread (0: nothing available, 1: from spare, 2: from depot)
+static int pool_reload(pool *p, pool_local *l) {
+  if (l->spare->count > 0) {
+    pool_mag *m = l->loaded;
+    l->loaded = l->spare;
+    l->spare = m;
+    return 1;
+  }
+  pool_mag *m = depot_pop(&p->full);
+  if (m == NULL) { return 0; }
+  atomic_fetch_sub(&p->full_count, 1);
+  depot_push(&p->empty, l->loaded);
+  l->loaded = m;
+  return 2;
+}
+
+// make room in loaded magazine of thread id (0: no room, 1: via spare, 2: full one to depot, 3: surplus to owner)
+static int pool_unload(pool *p, pool_local *l, int id) {
+  if (l->spare->count < POOL_MAG_SIZE) {
+    pool_mag *m = l->loaded;
+    l->loaded = l->spare;
+    l->spare = m;
+    return 1;
+  }
+  if (atomic_load(&p->full_count) >= p->high_water) {
+    for (int i = 0; i < l->loaded->count; i++) {
+      pool_drop(p, id, l->loaded->items[i]);
+    }
+    l->loaded->count = 0;
+    return 3;
+  }
+  pool_mag *m = mag_empty(p);
+  if (m == NULL) { return 0; }  // buy more RAM
+  atomic_fetch_add(&p->full_count, 1);
+  depot_push(&p->full, l->loaded);
+  l->loaded = m;
+  return 2;
+}
+
+// get spare node (NULL if there is none)
+static void *pool_get(pool *p, int id) {
+  pool_local *l = &p->locals[id];
+  if (l->loaded->count == 0 && pool_reload(p, l) == 0) { return NULL; }
+  return l->loaded->items[--l->loaded->count];
+}
+
+// get spare node (including statistics)
+static void *pool_get_stats(pool *p, int id, stats *s) {
+  pool_local *l = &p->locals[id];
+  if (l->loaded->count == 0) {
+    int r = pool_reload(p, l);
+    if (r == 0) { return NULL; }
+    if (r == 2) { s->depot_get++; }
+  }
+  s->freelist_len = l->loaded->count + l->spare->count - 1;
+  return l->loaded->items[--l->loaded->count];
+}
+
+// hand back spare node
+static void pool_put(pool *p, int id, void *n) {
+  pool_local *l = &p->locals[id];
+  if (l->loaded->count == POOL_MAG_SIZE && pool_unload(p, l, id) == 0) {
+    pool_drop(p, id, n);  // no magazine left, buy more RAM
+    return;
+  }
+  l->loaded->items[l->loaded->count++] = n;
+}
+
+// hand back spare node (including statistics)
+static void pool_put_stats(pool *p, int id, void *n, stats *s) {
+  pool_local *l = &p->locals[id];
+  if (l->loaded->count == POOL_MAG_SIZE) {
+    int r = pool_unload(p, l, id);
+    if (r == 0) {
+      pool_drop(p, id, n);  // no magazine left, buy more RAM
+      return;
+    }
+    if (r == 2) { s->depot_put++; }
+    if (r == 3) { s->depot_free += POOL_MAG_SIZE; }
+  }
+  l->loaded->items[l->loaded->count++] = n;
+  s->freelist_insert++;
+  s->freelist_len = l->loaded->count + l->spare->count;
+  if (s->freelist_len > s->freelist_max) {
+    s->freelist_max = s->freelist_len;
+  }
+}
+
+// free all magazines (and the nodes they hold if the pool owns them, slab nodes go with their slab)
+static void pool_destroy(pool *p) {
+  pool_mag *m;
+  while ((m = depot_pop(&p->full)) != NULL) {
+    for (int i = 0; p->owner == NULL && i < m->count; i++) {
+      free(m->items[i]);
+    }
+    free(m);
+  }
+  while ((m = depot_pop(&p->empty)) != NULL) {
+    free(m);
+  }
+  if (p->locals == NULL) { return; }
+  for (int i = 0; i < p->max_threads; i++) {
+    pool_mag *ms[2] = { p->locals[i].loaded, p->locals[i].spare };
+    for (int j = 0; j < 2; j++) {
+      if (ms[j] == NULL) { continue; }
+      for (int k = 0; p->owner == NULL && k < ms[j]->count; k++) {
+        free(ms[j]->items[k]);
+      }
+      free(ms[j]);
+    }
+  }
+  free(p->locals);
+}
+
+#endif
@@ -2,9 +2,60 @@
 #define QUEUE_H
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hist.h"
+#include "perf.h"
 
-// type definition of the value
+// cache line size in bytes
+#ifndef CACHE_LINE
+#define CACHE_LINE 64
+#endif
+
+// give member its own cache line (build with -DNO_PAD for the packed layout)
+#ifdef NO_PAD
+#define PADDED
+#else
+#define PADDED _Alignas(CACHE_LINE)
+#endif
+
+// allocate zeroed memory starting on a cache line
+static void *calloc_padded(size_t n, size_t size) {
+  size_t bytes = (n * size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+  void *p = aligned_alloc(CACHE_LINE, bytes);
+  if (p == NULL) { return NULL; }  // buy more RAM
+  memset(p, 0, bytes);
+  return p;
+}
+
+// payload size in bytes (values are stored inline in nodes/slots)
+#ifndef PAYLOAD
+#define PAYLOAD 4
+#endif
+
+// type definition of the value (int key, padded with opaque bytes up to PAYLOAD)
+// VALUE(k) builds a value with key k, KEY(v) gets the key back
+#if PAYLOAD == 4
 typedef int value_t;
+#define VALUE(k) ((value_t)(k))
+#define KEY(v) ((int)(v))
+#else
+typedef struct {
+  int key;
+  char data[PAYLOAD - sizeof(int)];
+} value_t;
+#define VALUE(k) ((value_t){ .key = (k) })
+#define KEY(v) ((v).key)
+#endif
+
+_Static_assert(sizeof(value_t) == PAYLOAD, "PAYLOAD has to be a multiple of sizeof(int)");
+
+// values per node of the linked list variants (unrolled list, 1 gives one value per node)
+#ifndef UNROLL
+#define UNROLL 1
+#endif
+
+_Static_assert(UNROLL > 0, "UNROLL has to be positive");
 
 // node definition (general here)
 typedef struct node node;
@@ -14,7 +65,7 @@ typedef struct queue queue;
 
 // statistics definition
 typedef struct {
-  double duration;
+  PADDED double duration;
 
   long enq_succ;
   long enq_fail;
@@ -27,6 +78,49 @@ typedef struct {
 
   long cas_succ;
   long cas_fail;
+
+  long seg_alloc;
+
+  long node_alloc;
+  long depot_put;
+  long depot_get;
+  long depot_free;
+
+  long alloc_chunks;
+  long alloc_bytes;
+
+  long smr_reclaimed;
+  long smr_pending;
+
+  long fc_passes;
+  long fc_combined;
+  long fc_max;
+
+  long backoff_waits;
+  long backoff_spins;
+  long backoff_ns;
+
+  long wait_spins;
+  long wait_parks;
+  long wait_woken;
+  long wait_latency_ns;
+  long wake_calls;
+  long cpu_ns;
+
+  long steals;
+  long stolen;
+
+  long cohort_local;
+  long cohort_global;
+  long numa_remote;
+
+  // counters of the kernel around the worker loop (bench -H, see perf.h)
+  long perf[PERF_EVENTS];
+  long perf_mask;
+
+  // sampled per call latencies (bench -l)
+  hist enq_lat;
+  hist deq_lat;
 } stats;
 
 // combine different statistics to one
@@ -44,6 +138,40 @@ static stats comb_stats(stats *ss, int len) {
     }
     s.cas_succ += ss[i].cas_succ;
     s.cas_fail += ss[i].cas_fail;
+    s.seg_alloc += ss[i].seg_alloc;
+    s.node_alloc += ss[i].node_alloc;
+    s.depot_put += ss[i].depot_put;
+    s.depot_get += ss[i].depot_get;
+    s.depot_free += ss[i].depot_free;
+    s.alloc_chunks += ss[i].alloc_chunks;
+    s.alloc_bytes += ss[i].alloc_bytes;
+    s.smr_reclaimed += ss[i].smr_reclaimed;
+    s.smr_pending += ss[i].smr_pending;
+    s.fc_passes += ss[i].fc_passes;
+    s.fc_combined += ss[i].fc_combined;
+    if (ss[i].fc_max > s.fc_max) {
+      s.fc_max = ss[i].fc_max;
+    }
+    s.backoff_waits += ss[i].backoff_waits;
+    s.backoff_spins += ss[i].backoff_spins;
+    s.backoff_ns += ss[i].backoff_ns;
+    s.wait_spins += ss[i].wait_spins;
+    s.wait_parks += ss[i].wait_parks;
+    s.wait_woken += ss[i].wait_woken;
+    s.wait_latency_ns += ss[i].wait_latency_ns;
+    s.wake_calls += ss[i].wake_calls;
+    s.cpu_ns += ss[i].cpu_ns;
+    s.steals += ss[i].steals;
+    s.stolen += ss[i].stolen;
+    s.cohort_local += ss[i].cohort_local;
+    s.cohort_global += ss[i].cohort_global;
+    s.numa_remote += ss[i].numa_remote;
+    for (int j = 0; j < PERF_EVENTS; j++) {
+      s.perf[j] += ss[i].perf[j];
+    }
+    s.perf_mask |= ss[i].perf_mask;
+    hist_merge(&s.enq_lat, &ss[i].enq_lat);
+    hist_merge(&s.deq_lat, &ss[i].deq_lat);
   }
   s.duration /= len;
   return s;
@@ -61,12 +189,84 @@ static void print_stats(stats *s) {
   printf(" freelist_max: %ld\n", s->freelist_max);
   printf(" cas_succ: %ld\n", s->cas_succ);
   printf(" cas_fail: %ld\n", s->cas_fail);
+  printf(" seg_alloc: %ld\n", s->seg_alloc);
+  printf(" node_alloc: %ld\n", s->node_alloc);
+  printf(" depot_put: %ld\n", s->depot_put);
+  printf(" depot_get: %ld\n", s->depot_get);
+  printf(" depot_free: %ld\n", s->depot_free);
+  printf(" alloc_chunks: %ld\n", s->alloc_chunks);
+  printf(" alloc_bytes: %ld\n", s->alloc_bytes);
+  printf(" smr_reclaimed: %ld\n", s->smr_reclaimed);
+  printf(" smr_pending: %ld\n", s->smr_pending);
+  printf(" fc_passes: %ld\n", s->fc_passes);
+  printf(" fc_combined: %ld\n", s->fc_combined);
+  printf(" fc_max: %ld\n", s->fc_max);
+  printf(" backoff_waits: %ld\n", s->backoff_waits);
+  printf(" backoff_spins: %ld\n", s->backoff_spins);
+  printf(" backoff_ns: %ld\n", s->backoff_ns);
+  printf(" wait_spins: %ld\n", s->wait_spins);
+  printf(" wait_parks: %ld\n", s->wait_parks);
+  printf(" wait_woken: %ld\n", s->wait_woken);
+  printf(" wait_latency_ns: %ld\n", s->wait_latency_ns);
+  printf(" wake_calls: %ld\n", s->wake_calls);
+  printf(" cpu_ns: %ld\n", s->cpu_ns);
+  printf(" steals: %ld\n", s->steals);
+  printf(" stolen: %ld\n", s->stolen);
+  printf(" cohort_local: %ld\n", s->cohort_local);
+  printf(" cohort_global: %ld\n", s->cohort_global);
+  printf(" numa_remote: %ld\n", s->numa_remote);
+  perf_print(s->perf, s->perf_mask);
+  hist_print("enq_lat", &s->enq_lat);
+  hist_print("deq_lat", &s->deq_lat);
+}
+
+// statistics as fields of a json object (every field with a leading comma, see bench -j)
+static void json_stats(FILE *f, stats *s) {
+  fprintf(f, ", \"duration\": %f", s->duration);
+  fprintf(f, ", \"enq_succ\": %ld", s->enq_succ);
+  fprintf(f, ", \"enq_fail\": %ld", s->enq_fail);
+  fprintf(f, ", \"deq_succ\": %ld", s->deq_succ);
+  fprintf(f, ", \"deq_fail\": %ld", s->deq_fail);
+  fprintf(f, ", \"freelist_insert\": %ld", s->freelist_insert);
+  fprintf(f, ", \"freelist_max\": %ld", s->freelist_max);
+  fprintf(f, ", \"cas_succ\": %ld", s->cas_succ);
+  fprintf(f, ", \"cas_fail\": %ld", s->cas_fail);
+  fprintf(f, ", \"seg_alloc\": %ld", s->seg_alloc);
+  fprintf(f, ", \"node_alloc\": %ld", s->node_alloc);
+  fprintf(f, ", \"depot_put\": %ld", s->depot_put);
+  fprintf(f, ", \"depot_get\": %ld", s->depot_get);
+  fprintf(f, ", \"depot_free\": %ld", s->depot_free);
+  fprintf(f, ", \"alloc_chunks\": %ld", s->alloc_chunks);
+  fprintf(f, ", \"alloc_bytes\": %ld", s->alloc_bytes);
+  fprintf(f, ", \"smr_reclaimed\": %ld", s->smr_reclaimed);
+  fprintf(f, ", \"smr_pending\": %ld", s->smr_pending);
+  fprintf(f, ", \"fc_passes\": %ld", s->fc_passes);
+  fprintf(f, ", \"fc_combined\": %ld", s->fc_combined);
+  fprintf(f, ", \"fc_max\": %ld", s->fc_max);
+  fprintf(f, ", \"backoff_waits\": %ld", s->backoff_waits);
+  fprintf(f, ", \"backoff_spins\": %ld", s->backoff_spins);
+  fprintf(f, ", \"backoff_ns\": %ld", s->backoff_ns);
+  fprintf(f, ", \"wait_spins\": %ld", s->wait_spins);
+  fprintf(f, ", \"wait_parks\": %ld", s->wait_parks);
+  fprintf(f, ", \"wait_woken\": %ld", s->wait_woken);
+  fprintf(f, ", \"wait_latency_ns\": %ld", s->wait_latency_ns);
+  fprintf(f, ", \"wake_calls\": %ld", s->wake_calls);
+  fprintf(f, ", \"cpu_ns\": %ld", s->cpu_ns);
+  fprintf(f, ", \"steals\": %ld", s->steals);
+  fprintf(f, ", \"stolen\": %ld", s->stolen);
+  fprintf(f, ", \"cohort_local\": %ld", s->cohort_local);
+  fprintf(f, ", \"cohort_global\": %ld", s->cohort_global);
+  fprintf(f, ", \"numa_remote\": %ld", s->numa_remote);
+  perf_json(f, s->perf, s->perf_mask);
+  hist_json(f, "enq_lat", &s->enq_lat);
+  hist_json(f, "deq_lat", &s->deq_lat);
 }
 
 // queue return codes
 #define QUEUE_OK    0
 #define QUEUE_EMPTY 1
 #define QUEUE_NOMEM 2
+#define QUEUE_FULL  3
 
 // explain quque return codes
 static const char* q_error(int code) {
@@ -74,10 +274,60 @@ static const char* q_error(int code) {
     case QUEUE_OK:    return "Successful";
     case QUEUE_EMPTY: return "Queue empty";
     case QUEUE_NOMEM: return "Out of memory";
+    case QUEUE_FULL:  return "Queue full";
     default:          return "Unknown";
   }
 }
 
+// variant flags
+#define QUEUE_SEQUENTIAL 1  // not safe to share between threads
+#define QUEUE_SP         2  // at most one enqueuing thread
+#define QUEUE_SC         4  // at most one dequeuing thread
+#define QUEUE_SPSC       (QUEUE_SP | QUEUE_SC)
+
+// operations of a variant (lets one binary hold several variants)
+typedef struct queue_ops {
+  const char *name;
+  int flags;
+  queue* (*create)();
+  int (*init)(queue *q);
+  int (*enq)(value_t v, queue *q);
+  int (*enq_stats)(value_t v, queue *q, stats *s);
+  int (*deq)(value_t *v, queue *q);
+  int (*deq_stats)(value_t *v, queue *q, stats *s);
+  int (*enq_batch)(const value_t *vs, int n, queue *q);
+  int (*enq_batch_stats)(const value_t *vs, int n, queue *q, stats *s);
+  int (*deq_batch)(value_t *vs, int max, queue *q);
+  int (*deq_batch_stats)(value_t *vs, int max, queue *q, stats *s);
+  int (*deq_wait)(value_t *v, queue *q, double timeout);
+  int (*deq_wait_stats)(value_t *v, queue *q, double timeout, stats *s);
+  int (*len)(queue *q);
+  void (*destroy)(queue *q);
+} queue_ops;
+
+#define QUEUE_STR_(x) #x
+#define QUEUE_STR(x) QUEUE_STR_(x)
+#define QUEUE_CAT_(a, b) a##_##b
+#define QUEUE_CAT(a, b) QUEUE_CAT_(a, b)
+
+// prefix the api with the variant name (build with -DQUEUE_NAME=<variant> to link several variants together)
+#ifdef QUEUE_NAME
+#define create QUEUE_CAT(QUEUE_NAME, create)
+#define init QUEUE_CAT(QUEUE_NAME, init)
+#define enq QUEUE_CAT(QUEUE_NAME, enq)
+#define enq_stats QUEUE_CAT(QUEUE_NAME, enq_stats)
+#define deq QUEUE_CAT(QUEUE_NAME, deq)
+#define deq_stats QUEUE_CAT(QUEUE_NAME, deq_stats)
+#define enq_batch QUEUE_CAT(QUEUE_NAME, enq_batch)
+#define enq_batch_stats QUEUE_CAT(QUEUE_NAME, enq_batch_stats)
+#define deq_batch QUEUE_CAT(QUEUE_NAME, deq_batch)
+#define deq_batch_stats QUEUE_CAT(QUEUE_NAME, deq_batch_stats)
+#define deq_wait QUEUE_CAT(QUEUE_NAME, deq_wait)
+#define deq_wait_stats QUEUE_CAT(QUEUE_NAME, deq_wait_stats)
+#define len QUEUE_CAT(QUEUE_NAME, len)
+#define destroy QUEUE_CAT(QUEUE_NAME, destroy)
+#endif
+
 // create queue
 queue* create();
 
@@ -96,6 +346,24 @@ int deq(value_t *v, queue *q);
 // dequeue from queue (including statistics)
 int deq_stats(value_t *v, queue *q, stats *s);
 
+// enqueue multiple values in queue (returns number of enqueued values)
+int enq_batch(const value_t *vs, int n, queue *q);
+
+// enqueue multiple values in queue (including statistics)
+int enq_batch_stats(const value_t *vs, int n, queue *q, stats *s);
+
+// dequeue up to max values from queue (returns number of dequeued values)
+int deq_batch(value_t *vs, int max, queue *q);
+
+// dequeue up to max values from queue (including statistics)
+int deq_batch_stats(value_t *vs, int max, queue *q, stats *s);
+
+// dequeue from queue, sleep while it is empty (at most timeout seconds, forever if timeout < 0)
+int deq_wait(value_t *v, queue *q, double timeout);
+
+// dequeue from queue, sleep while it is empty (including statistics)
+int deq_wait_stats(value_t *v, queue *q, double timeout, stats *s);
+
 // length of queue
 int len(queue *q);
 
@@ -0,0 +1,74 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include "queue.h"
+
+// variants linked into the single bench binary (name, flags); keep in sync with VARIANTS_REGISTRY in the Makefile
+#define QUEUE_VARIANTS(X) \
+  X(seq, QUEUE_SEQUENTIAL) \
+  X(conc, 0) \
+  X(conc2, 0) \
+  X(cas, 0) \
+  X(ring, 0) \
+  X(faa, 0) \
+  X(fc, 0) \
+  X(baskets, 0) \
+  X(bag, 0) \
+  X(numa, 0) \
+  X(spsc, QUEUE_SPSC) \
+  X(mpsc, QUEUE_SC) \
+  X(spmc, QUEUE_SP) \
+  X(cas_hp, 0) \
+  X(cas_ebr, 0) \
+  X(cas_dw, 0) \
+  X(numa_sim, 0) \
+  X(conc_tas, 0) \
+  X(conc_ticket, 0) \
+  X(conc_mcs, 0) \
+  X(conc_clh, 0) \
+  X(conc2_tas, 0) \
+  X(conc2_ticket, 0) \
+  X(conc2_mcs, 0) \
+  X(conc2_clh, 0) \
+  X(conc_lwalk, 0) \
+  X(conc2_lwalk, 0) \
+  X(cas_lwalk, 0) \
+  X(faa_lwalk, 0) \
+  X(fc_lwalk, 0) \
+  X(baskets_lwalk, 0) \
+  X(bag_lwalk, 0) \
+  X(mpsc_lwalk, QUEUE_SC) \
+  X(conc_lexact, 0) \
+  X(conc2_lexact, 0) \
+  X(fc_lexact, 0)
+
+// prefixed api of a variant (see QUEUE_NAME in queue.h)
+#define QUEUE_DECLARE(name, flags) \
+  queue* name##_create(); \
+  int name##_init(queue *q); \
+  int name##_enq(value_t v, queue *q); \
+  int name##_enq_stats(value_t v, queue *q, stats *s); \
+  int name##_deq(value_t *v, queue *q); \
+  int name##_deq_stats(value_t *v, queue *q, stats *s); \
+  int name##_enq_batch(const value_t *vs, int n, queue *q); \
+  int name##_enq_batch_stats(const value_t *vs, int n, queue *q, stats *s); \
+  int name##_deq_batch(value_t *vs, int max, queue *q); \
+  int name##_deq_batch_stats(value_t *vs, int max, queue *q, stats *s); \
+  int name##_deq_wait(value_t *v, queue *q, double timeout); \
+  int name##_deq_wait_stats(value_t *v, queue *q, double timeout, stats *s); \
+  int name##_len(queue *q); \
+  void name##_destroy(queue *q);
+
+QUEUE_VARIANTS(QUEUE_DECLARE)
+
+// operations of a variant
+#define QUEUE_ENTRY(name, flags) { #name, flags, name##_create, name##_init, name##_enq, name##_enq_stats, name##_deq, name##_deq_stats, \
+  name##_enq_batch, name##_enq_batch_stats, name##_deq_batch, name##_deq_batch_stats, \
+  name##_deq_wait, name##_deq_wait_stats, name##_len, name##_destroy },
+
+// all variants
+static const queue_ops registry[] = {
+  QUEUE_VARIANTS(QUEUE_ENTRY)
+};
+
+#endif
@@ -0,0 +1,273 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "queue.h"
+#include "wait.h"
+#include <omp.h>
+
+#define CAS atomic_compare_exchange_weak // weak|strong
+
+// capacity of the ring (has to be a power of two)
+#ifndef RING_SIZE
+#define RING_SIZE (1 << 20)
+#endif
+
+_Static_assert((RING_SIZE & (RING_SIZE - 1)) == 0, "RING_SIZE has to be a power of two");
+
+// slot definition (value and sequence number telling who may use the slot next)
+typedef struct slot {
+  _Atomic(size_t) seq;
+  value_t value;
+} slot;
+
+// queue definition
+typedef struct queue {
+  slot *slots;
+  size_t mask;
+  PADDED _Atomic(size_t) enq_pos;
+  PADDED _Atomic(size_t) deq_pos;
+  waiter waiting;
+} queue;
+
+// create queue
+queue* create() {
+  queue *q = (queue*)calloc_padded(1, sizeof(queue));
+  if (!q) { return NULL; }  // buy more RAM
+  return q;
+}
+
+// initialize queue
+int init(queue *q) {
+  q->slots = (slot*)calloc_padded(RING_SIZE, sizeof(slot));
+  if (q->slots == NULL) { return QUEUE_NOMEM; }  // buy more RAM
+  q->mask = RING_SIZE - 1;
+  for (size_t i = 0; i < RING_SIZE; i++) {
+    atomic_store(&q->slots[i].seq, i);
+  }
+  atomic_store(&q->enq_pos, 0);
+  atomic_store(&q->deq_pos, 0);
+  wait_init(&q->waiting);
+  return QUEUE_OK;
+}
+
+// enqueue in queue
+int enq(value_t v, queue *q) {
+  size_t pos = atomic_load(&q->enq_pos);
+  slot *sl;
+  while(1) {
+    sl = &q->slots[pos & q->mask];
+    size_t seq = atomic_load(&sl->seq);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0) {
+      if (CAS(&q->enq_pos, &pos, pos + 1)) { break; }
+    } else if (diff < 0) {
+      if ((intptr_t)(pos - atomic_load(&q->deq_pos)) > (intptr_t)q->mask) { return QUEUE_FULL; }
+      pos = atomic_load(&q->enq_pos);  // slot still being read by a dequeuer
+    } else {
+      pos = atomic_load(&q->enq_pos);
+    }
+  }
+  sl->value = v;
+  atomic_store(&sl->seq, pos + 1);
+  wait_wake(&q->waiting, 1);
+  return QUEUE_OK;
+}
+
+// enqueue in queue (including statistics)
+int enq_stats(value_t v, queue *q, stats *s) {
+  size_t pos = atomic_load(&q->enq_pos);
+  slot *sl;
+  while(1) {
+    sl = &q->slots[pos & q->mask];
+    size_t seq = atomic_load(&sl->seq);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0) {
+      if (CAS(&q->enq_pos, &pos, pos + 1)) { s->cas_succ++; break; } else { s->cas_fail++; }
+    } else if (diff < 0) {
+      if ((intptr_t)(pos - atomic_load(&q->deq_pos)) > (intptr_t)q->mask) { return QUEUE_FULL; }
+      pos = atomic_load(&q->enq_pos);  // slot still being read by a dequeuer
+    } else {
+      pos = atomic_load(&q->enq_pos);
+    }
+  }
+  sl->value = v;
+  atomic_store(&sl->seq, pos + 1);
+  wait_wake_stats(&q->waiting, 1, s);
+  return QUEUE_OK;
+}
+
+// dequeue from queue
+int deq(value_t *v, queue *q) {
+  size_t pos = atomic_load(&q->deq_pos);
+  slot *sl;
+  while(1) {
+    sl = &q->slots[pos & q->mask];
+    size_t seq = atomic_load(&sl->seq);
+    intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (diff == 0) {
+      if (CAS(&q->deq_pos, &pos, pos + 1)) { break; }
+    } else if (diff < 0) {
+      if (pos == atomic_load(&q->enq_pos)) { return QUEUE_EMPTY; }
+      pos = atomic_load(&q->deq_pos);  // slot still being written by an enqueuer
+    } else {
+      pos = atomic_load(&q->deq_pos);
+    }
+  }
+  *v = sl->value;
+  atomic_store(&sl->seq, pos + q->mask + 1);
+  return QUEUE_OK;
+}
+
+// dequeue from queue (including statistics)
+int deq_stats(value_t *v, queue *q, stats *s) {
+  size_t pos = atomic_load(&q->deq_pos);
+  slot *sl;
+  while(1) {
+    sl = &q->slots[pos & q->mask];
+    size_t seq = atomic_load(&sl->seq);
+    intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (diff == 0) {
+      if (CAS(&q->deq_pos, &pos, pos + 1)) { s->cas_succ++; break; } else { s->cas_fail++; }
+    } else if (diff < 0) {
+      if (pos == atomic_load(&q->enq_pos)) { return QUEUE_EMPTY; }
+      pos = atomic_load(&q->deq_pos);  // slot still being written by an enqueuer
+    } else {
+      pos = atomic_load(&q->deq_pos);
+    }
+  }
+  *v = sl->value;
+  atomic_store(&sl->seq, pos + q->mask + 1);
+  return QUEUE_OK;
+}
+
+// enqueue multiple values in queue (returns number of enqueued values)
+int enq_batch(const value_t *vs, int n, queue *q) {
+  if (n <= 0) { return 0; }
+  size_t pos = atomic_load(&q->enq_pos);
+  int c;
+  while(1) {
+    // count consecutive free slots, then claim all of them at once
+    c = 0;
+    while (c < n && atomic_load(&q->slots[(pos + c) & q->mask].seq) == pos + c) { c++; }
+    if (c > 0) {
+      if (CAS(&q->enq_pos, &pos, pos + c)) { break; }
+      continue;
+    }
+    intptr_t diff = (intptr_t)atomic_load(&q->slots[pos & q->mask].seq) - (intptr_t)pos;
+    if (diff < 0) {
+      if ((intptr_t)(pos - atomic_load(&q->deq_pos)) > (intptr_t)q->mask) { return 0; }
+    }
+    pos = atomic_load(&q->enq_pos);
+  }
+  for (int i = 0; i < c; i++) {
+    slot *sl = &q->slots[(pos + i) & q->mask];
+    sl->value = vs[i];
+    atomic_store(&sl->seq, pos + i + 1);
+  }
+  wait_wake(&q->waiting, c);
+  return c;
+}
+
+// enqueue multiple values in queue (including statistics)
+int enq_batch_stats(const value_t *vs, int n, queue *q, stats *s) {
+  if (n <= 0) { return 0; }
+  size_t pos = atomic_load(&q->enq_pos);
+  int c;
+  while(1) {
+    // count consecutive free slots, then claim all of them at once
+    c = 0;
+    while (c < n && atomic_load(&q->slots[(pos + c) & q->mask].seq) == pos + c) { c++; }
+    if (c > 0) {
+      if (CAS(&q->enq_pos, &pos, pos + c)) { s->cas_succ++; break; } else { s->cas_fail++; }
+      continue;
+    }
+    intptr_t diff = (intptr_t)atomic_load(&q->slots[pos & q->mask].seq) - (intptr_t)pos;
+    if (diff < 0) {
+      if ((intptr_t)(pos - atomic_load(&q->deq_pos)) > (intptr_t)q->mask) { return 0; }
+    }
+    pos = atomic_load(&q->enq_pos);
+  }
+  for (int i = 0; i < c; i++) {
+    slot *sl = &q->slots[(pos + i) & q->mask];
+    sl->value = vs[i];
+    atomic_store(&sl->seq, pos + i + 1);
+  }
+  wait_wake_stats(&q->waiting, c, s);
+  return c;
+}
+
+// dequeue up to max values from queue (returns number of dequeued values)
+int deq_batch(value_t *vs, int max, queue *q) {
+  if (max <= 0) { return 0; }
+  size_t pos = atomic_load(&q->deq_pos);
+  int c;
+  while(1) {
+    // count consecutive filled slots, then claim all of them at once
+    c = 0;
+    while (c < max && atomic_load(&q->slots[(pos + c) & q->mask].seq) == pos + c + 1) { c++; }
+    if (c > 0) {
+      if (CAS(&q->deq_pos, &pos, pos + c)) { break; }
+      continue;
+    }
+    intptr_t diff = (intptr_t)atomic_load(&q->slots[pos & q->mask].seq) - (intptr_t)(pos + 1);
+    if (diff < 0) {
+      if (pos == atomic_load(&q->enq_pos)) { return 0; }
+    }
+    pos = atomic_load(&q->deq_pos);
+  }
+  for (int i = 0; i < c; i++) {
+    slot *sl = &q->slots[(pos + i) & q->mask];
+    vs[i] = sl->value;
+    atomic_store(&sl->seq, pos + i + q->mask + 1);
+  }
+  return c;
+}
+
+// dequeue up to max values from queue (including statistics)
+int deq_batch_stats(value_t *vs, int max, queue *q, stats *s) {
+  if (max <= 0) { return 0; }
+  size_t pos = atomic_load(&q->deq_pos);
+  int c;
+  while(1) {
+    // count consecutive filled slots, then claim all of them at once
+    c = 0;
+    while (c < max && atomic_load(&q->slots[(pos + c) & q->mask].seq) == pos + c + 1) { c++; }
+    if (c > 0) {
+      if (CAS(&q->deq_pos, &pos, pos + c)) { s->cas_succ++; break; } else { s->cas_fail++; }
+      continue;
+    }
+    intptr_t diff = (intptr_t)atomic_load(&q->slots[pos & q->mask].seq) - (intptr_t)(pos + 1);
+    if (diff < 0) {
+      if (pos == atomic_load(&q->enq_pos)) { return 0; }
+    }
+    pos = atomic_load(&q->deq_pos);
+  }
+  for (int i = 0; i < c; i++) {
+    slot *sl = &q->slots[(pos + i) & q->mask];
+    vs[i] = sl->value;
+    atomic_store(&sl->seq, pos + i + q->mask + 1);
+  }
+  return c;
+}
+
+// dequeue from queue, sleep while it is empty (at most timeout seconds, forever if timeout < 0)
+int deq_wait(value_t *v, queue *q, double timeout) {
+  return wait_deq(&q->waiting, deq, v, q, timeout);
+}
+
+// dequeue from queue, sleep while it is empty (including statistics)
+int deq_wait_stats(value_t *v, queue *q, double timeout, stats *s) {
+  return wait_deq_stats(&q->waiting, deq_stats, v, q, timeout, s);
+}
+
+// length of queue
+int len(queue *q) {
+  size_t deq_pos = atomic_load(&q->deq_pos);
+  return (int)(atomic_load(&q->enq_pos) - deq_pos);
+}
+
+// destroy queue
+void destroy(queue *q) {
+  free(q->slots);
+  free(q);
+}
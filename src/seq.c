@@ -1,146 +1,93 @@
 #include <stdlib.h>
 #include "queue.h"
+#include "list.h"
+#include "wait.h"
 #include <omp.h>
 
-// node definition
-typedef struct node {
-  value_t value;
-  struct node *next;
-} node;
-
-// queue definition
+// queue definition (the sequential list itself, see list.h)
 typedef struct queue {
-  node *head;
-  node *tail;
-  node **freelists;
-  int max_threads;
+  list l;
+  waiter waiting;
 } queue;
 
 // create queue
 queue* create() {
-  queue *q = (queue*)malloc(sizeof(queue));
+  queue *q = (queue*)calloc_padded(1, sizeof(queue));
   if (!q) { return NULL; }  // buy more RAM
   return q;
 }
 
 // initialize queue
 int init(queue *q) {
-  q->max_threads = omp_get_max_threads();
-  q->freelists = (node**)calloc(q->max_threads, sizeof(node*));
-  if (q->freelists == NULL) { return QUEUE_NOMEM; }  // buy more RAM
-  node *n = (node*)malloc(sizeof(node));
-  if (n == NULL) {
-    free(q->freelists);
-    return QUEUE_NOMEM;
-  }  // buy more RAM
-  n->next = NULL;
-  q->head = n;
-  q->tail = n;
-  return QUEUE_OK;
+  wait_init(&q->waiting);
+  return list_init(&q->l, omp_get_max_threads(), omp_get_thread_num());
 }
 
 // enqueue in queue
 int enq(value_t v, queue *q) {
-  int id = omp_get_thread_num();
-  node *n;
-  if (q->freelists[id] == NULL) {
-    n = (node*)malloc(sizeof(node));
-    if (n == NULL) { return QUEUE_NOMEM; }  // buy more RAM
-  } else {
-    n = q->freelists[id];
-    q->freelists[id] = n->next;
-  }
-  n->next = NULL;
-  n->value = v;
-  q->tail->next = n;
-  q->tail = n;
-  return QUEUE_OK;
+  int ret = list_enq(&q->l, omp_get_thread_num(), v);
+  if (ret == QUEUE_OK) { wait_wake(&q->waiting, 1); }
+  return ret;
 }
 
 // enqueue in queue (including statistics)
 int enq_stats(value_t v, queue *q, stats *s) {
-  int id = omp_get_thread_num();
-  node *n;
-  if (q->freelists[id] == NULL) {
-    n = (node*)malloc(sizeof(node));
-    if (n == NULL) { return QUEUE_NOMEM; }  // buy more RAM
-  } else {
-    n = q->freelists[id];
-    q->freelists[id] = n->next;
-    s->freelist_len--;
-  }
-  n->next = NULL;
-  n->value = v;
-  q->tail->next = n;
-  q->tail = n;
-  return QUEUE_OK;
+  int ret = list_enq_stats(&q->l, omp_get_thread_num(), v, s);
+  if (ret == QUEUE_OK) { wait_wake_stats(&q->waiting, 1, s); }
+  return ret;
 }
 
 // dequeue from queue
 int deq(value_t *v, queue *q) {
-  int id = omp_get_thread_num();
-  node *old;
-  node *new;
-  old = q->head;
-  new = old->next;
-  if (new == NULL) { return QUEUE_EMPTY; }
-  *v = new->value;
-  q->head = new;
-  old->next = q->freelists[id];
-  q->freelists[id] = old;
-  return QUEUE_OK;
+  return list_deq(&q->l, omp_get_thread_num(), v);
 }
 
 // dequeue from queue (including statistics)
 int deq_stats(value_t *v, queue *q, stats *s) {
-  int id = omp_get_thread_num();
-  node *old;
-  node *new;
-  old = q->head;
-  new = old->next;
-  if (new == NULL) { return QUEUE_EMPTY; }
-  *v = new->value;
-  q->head = new;
-  old->next = q->freelists[id];
-  q->freelists[id] = old;
-  s->freelist_len++;
-  if (s->freelist_len > s->freelist_max) {
-    s->freelist_max = s->freelist_len;
-  }
-  s->freelist_insert++;
-  return QUEUE_OK;
+  return list_deq_stats(&q->l, omp_get_thread_num(), v, s);
+}
+
+// enqueue multiple values in queue (returns number of enqueued values)
+int enq_batch(const value_t *vs, int n, queue *q) {
+  int c = list_enq_batch(&q->l, omp_get_thread_num(), vs, n);
+  wait_wake(&q->waiting, c);
+  return c;
+}
+
+// enqueue multiple values in queue (including statistics)
+int enq_batch_stats(const value_t *vs, int n, queue *q, stats *s) {
+  int c = list_enq_batch_stats(&q->l, omp_get_thread_num(), vs, n, s);
+  wait_wake_stats(&q->waiting, c, s);
+  return c;
+}
+
+// dequeue up to max values from queue (returns number of dequeued values)
+int deq_batch(value_t *vs, int max, queue *q) {
+  return list_deq_batch(&q->l, omp_get_thread_num(), vs, max);
+}
+
+// dequeue up to max values from queue (including statistics)
+int deq_batch_stats(value_t *vs, int max, queue *q, stats *s) {
+  return list_deq_batch_stats(&q->l, omp_get_thread_num(), vs, max, s);
+}
+
+// dequeue from queue, sleep while it is empty (at most timeout seconds, forever if timeout < 0)
+int deq_wait(value_t *v, queue *q, double timeout) {
+  return wait_deq(&q->waiting, deq, v, q, timeout);
+}
+
+// dequeue from queue, sleep while it is empty (including statistics)
+int deq_wait_stats(value_t *v, queue *q, double timeout, stats *s) {
+  return wait_deq_stats(&q->waiting, deq_stats, v, q, timeout, s);
 }
 
 // length of queue
 int len(queue *q) {
-  node *n = q->head;
-  n = n->next;
-  int c = 0;
-  while (n != NULL) {
-    c++;
-    n = n->next;
-  }
-  return c;
+  return list_len(&q->l);
 }
 
 // destroy queue
 void destroy(queue *q) {
-  node *n = q->head;
-  while (n != NULL) {
-    node *next = n->next;
-    free(n);
-    n = next;
-  }
-
-  for (int i = 0; i < q->max_threads; i++) {
-    n = q->freelists[i];
-    while (n != NULL) {
-      node *next = n->next;
-      free(n);
-      n = next;
-    }
-  }
-  free(q->freelists);
+  list_destroy(&q->l);
   free(q);
 }
-
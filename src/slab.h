@@ -0,0 +1,116 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdlib.h>
+#include <stddef.h>
+#include "queue.h"
+
+// bytes per chunk nodes are carved from
+#ifndef SLAB_CHUNK_SIZE
+#define SLAB_CHUNK_SIZE (1 << 20)
+#endif
+
+// chunk header (gets a cache line of its own at the start of every chunk)
+typedef struct slab_chunk {
+  struct slab_chunk *next;
+} slab_chunk;
+
+// per thread part of the slab (only touched by its owner)
+typedef struct slab_local {
+  PADDED char *cur;
+  char *end;
+  slab_chunk *chunks;
+  void **spare;  // objects handed back with slab_free(), reused before new ones get carved
+  int spare_len;
+  int spare_cap;
+} slab_local;
+
+// slab definition (per thread bump allocator, memory is only returned in slab_destroy())
+typedef struct slab {
+  slab_local *locals;
+  size_t obj_size;
+  int max_threads;
+} slab;
+
+// initialize slab; objects are padded so that none of them straddles a cache line
+static int slab_init(slab *a, size_t obj_size, int max_threads) {
+  size_t size = 1;
+  while (size < obj_size && size < CACHE_LINE) {
+    size <<= 1;
+  }
+  if (obj_size > CACHE_LINE) {
+    size = (obj_size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+  }
+  a->obj_size = size;
+  a->max_threads = max_threads;
+  a->locals = (slab_local*)calloc_padded(max_threads, sizeof(slab_local));
+  if (a->locals == NULL) { return QUEUE_NOMEM; }  // buy more RAM
+  return QUEUE_OK;
+}
+
+// start a new chunk for thread
+static int slab_refill(slab_local *l) {
+  slab_chunk *c = (slab_chunk*)aligned_alloc(CACHE_LINE, SLAB_CHUNK_SIZE);
+  if (c == NULL) { return 0; }  // buy more RAM
+  c->next = l->chunks;
+  l->chunks = c;
+  l->cur = (char*)c + CACHE_LINE;
+  l->end = (char*)c + SLAB_CHUNK_SIZE;
+  return 1;
+}
+
+// allocate object (NULL if out of memory)
+static void *slab_alloc(slab *a, int id) {
+  slab_local *l = &a->locals[id];
+  if (l->spare_len > 0) { return l->spare[--l->spare_len]; }
+  if ((size_t)(l->end - l->cur) < a->obj_size && !slab_refill(l)) { return NULL; }
+  void *n = l->cur;
+  l->cur += a->obj_size;
+  return n;
+}
+
+// allocate object (including statistics)
+static void *slab_alloc_stats(slab *a, int id, stats *s) {
+  slab_local *l = &a->locals[id];
+  if (l->spare_len > 0) { return l->spare[--l->spare_len]; }
+  if ((size_t)(l->end - l->cur) < a->obj_size) {
+    if (!slab_refill(l)) { return NULL; }
+    s->alloc_chunks++;
+    s->alloc_bytes += SLAB_CHUNK_SIZE;
+  }
+  void *n = l->cur;
+  l->cur += a->obj_size;
+  s->node_alloc++;
+  return n;
+}
+
+// hand object back to the slab of thread id (its memory stays in the chunk, the object is left untouched
+// so stamps kept in it survive; if the spare list can not grow the object is only reclaimed by slab_destroy())
+static void slab_free(slab *a, int id, void *n) {
+  slab_local *l = &a->locals[id];
+  if (l->spare_len == l->spare_cap) {
+    int cap = l->spare_cap == 0 ? 1024 : 2 * l->spare_cap;
+    void **spare = (void**)realloc(l->spare, cap * sizeof(void*));
+    if (spare == NULL) { return; }  // buy more RAM
+    l->spare = spare;
+    l->spare_cap = cap;
+  }
+  l->spare[l->spare_len++] = n;
+}
+
+// free all chunks (and with them every object ever allocated)
+static void slab_destroy(slab *a) {
+  if (a->locals == NULL) { return; }
+  for (int i = 0; i < a->max_threads; i++) {
+    slab_chunk *c = a->locals[i].chunks;
+    while (c != NULL) {
+      slab_chunk *next = c->next;
+      free(c);
+      c = next;
+    }
+    free(a->locals[i].spare);
+  }
+  free(a->locals);
+}
+
+#endif
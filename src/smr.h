@@ -0,0 +1,256 @@
+#ifndef SMR_H
+#define SMR_H
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "queue.h"
+#include "pool.h"
+
+// safe memory reclamation: build with -DSMR_HP (hazard pointers) or -DSMR_EBR (epochs);
+// without either, retired nodes go straight back to the pool and have to stay type-stable
+#if defined(SMR_HP) && defined(SMR_EBR)
+#error "SMR_HP and SMR_EBR can not be used together"
+#endif
+#if defined(SMR_HP) || defined(SMR_EBR)
+#define SMR_ENABLED
+#endif
+
+// hazard pointers per thread
+#define SMR_HAZARDS 2
+
+// retired nodes per thread between two reclamation attempts
+#ifndef SMR_BATCH
+#define SMR_BATCH 64
+#endif
+
+// retired nodes (and the epoch they got retired in)
+typedef struct smr_list {
+  void **items;
+  int len;
+  int cap;
+  unsigned long epoch;
+} smr_list;
+
+// per thread part of the reclamation (hazards and announced epoch are read by everybody)
+typedef struct smr_local {
+  PADDED _Atomic(void*) hazards[SMR_HAZARDS];
+  _Atomic(unsigned long) epoch;
+  PADDED smr_list retired[3];
+  int pending;
+  long retires;
+} smr_local;
+
+// reclamation definition (reclaimed nodes are handed to the pool)
+typedef struct smr {
+  smr_local *locals;
+  PADDED _Atomic(unsigned long) epoch;
+  pool *sink;
+  int max_threads;
+} smr;
+
+// initialize reclamation
+static int smr_init(smr *r, pool *sink, int max_threads) {
+  r->sink = sink;
+  r->max_threads = max_threads;
+  atomic_store(&r->epoch, 0);
+  r->locals = (smr_local*)calloc_padded(max_threads, sizeof(smr_local));
+  if (r->locals == NULL) { return QUEUE_NOMEM; }  // buy more RAM
+  for (int i = 0; i < max_threads; i++) {
+    for (int h = 0; h < SMR_HAZARDS; h++) {
+      atomic_store(&r->locals[i].hazards[h], NULL);
+    }
+    atomic_store(&r->locals[i].epoch, 0);
+  }
+  return QUEUE_OK;
+}
+
+// hand reclaimed node to the pool
+static void smr_release(smr *r, int id, void *p, stats *s) {
+  if (s == NULL) {
+    pool_put(r->sink, id, p);
+  } else {
+    pool_put_stats(r->sink, id, p, s);
+  }
+}
+
+// append node to retired list (0 if out of memory)
+static int smr_push(smr_list *l, void *p) {
+  if (l->len == l->cap) {
+    int cap = l->cap == 0 ? SMR_BATCH : 2 * l->cap;
+    void **items = (void**)realloc(l->items, cap * sizeof(void*));
+    if (items == NULL) { return 0; }  // buy more RAM
+    l->items = items;
+    l->cap = cap;
+  }
+  l->items[l->len++] = p;
+  return 1;
+}
+
+// reclaim every node of retired list
+static int smr_flush(smr *r, int id, smr_list *l, stats *s) {
+  int c = l->len;
+  for (int i = 0; i < c; i++) {
+    smr_release(r, id, l->items[i], s);
+  }
+  l->len = 0;
+  return c;
+}
+
+#if defined(SMR_HP)
+
+// start of an operation
+static void smr_enter(smr *r, int id) {}
+
+// end of an operation (drop all hazard pointers of thread)
+static void smr_exit(smr *r, int id) {
+  for (int h = 0; h < SMR_HAZARDS; h++) {
+    atomic_store(&r->locals[id].hazards[h], NULL);
+  }
+}
+
+// publish hazard pointer i of thread (the caller has to check that p is still reachable afterwards)
+static void smr_hazard(smr *r, int id, int i, void *p) {
+  atomic_store(&r->locals[id].hazards[i], p);
+}
+
+// reclaim retired nodes no thread holds a hazard pointer to (returns number of reclaimed nodes)
+static int smr_scan(smr *r, int id, stats *s) {
+  smr_list *l = &r->locals[id].retired[0];
+  if (l->len < SMR_BATCH + SMR_HAZARDS * r->max_threads) { return 0; }
+  int kept = 0;
+  int c = 0;
+  for (int i = 0; i < l->len; i++) {
+    void *p = l->items[i];
+    int hazardous = 0;
+    for (int t = 0; t < r->max_threads && !hazardous; t++) {
+      for (int h = 0; h < SMR_HAZARDS; h++) {
+        if (atomic_load(&r->locals[t].hazards[h]) == p) {
+          hazardous = 1;
+          break;
+        }
+      }
+    }
+    if (hazardous) {
+      l->items[kept++] = p;
+    } else {
+      smr_release(r, id, p, s);
+      c++;
+    }
+  }
+  l->len = kept;
+  return c;
+}
+
+// retired list new nodes go to
+static smr_list *smr_list_of(smr *r, int id, stats *s, int *c) {
+  return &r->locals[id].retired[0];
+}
+
+#elif defined(SMR_EBR)
+
+// start of an operation (announce current epoch)
+static void smr_enter(smr *r, int id) {
+  atomic_store(&r->locals[id].epoch, (atomic_load(&r->epoch) << 1) | 1);
+}
+
+// end of an operation (thread is quiescent)
+static void smr_exit(smr *r, int id) {
+  atomic_store(&r->locals[id].epoch, 0);
+}
+
+// hazard pointers are not needed with epochs
+static void smr_hazard(smr *r, int id, int i, void *p) {}
+
+// advance global epoch once every active thread announced the current one
+static void smr_advance(smr *r) {
+  unsigned long e = atomic_load(&r->epoch);
+  for (int t = 0; t < r->max_threads; t++) {
+    unsigned long a = atomic_load(&r->locals[t].epoch);
+    if ((a & 1) && (a >> 1) != e) { return; }
+  }
+  atomic_compare_exchange_strong(&r->epoch, &e, e + 1);
+}
+
+// reclaim nodes retired at least two epochs ago (returns number of reclaimed nodes)
+static int smr_scan(smr *r, int id, stats *s) {
+  smr_local *l = &r->locals[id];
+  if (l->retires % SMR_BATCH != 0) { return 0; }
+  smr_advance(r);
+  unsigned long e = atomic_load(&r->epoch);
+  int c = 0;
+  for (int b = 0; b < 3; b++) {
+    if (l->retired[b].len > 0 && l->retired[b].epoch + 2 <= e) {
+      c += smr_flush(r, id, &l->retired[b], s);
+    }
+  }
+  return c;
+}
+
+// retired list of the current epoch (whatever is left in it from three epochs ago gets reclaimed first)
+static smr_list *smr_list_of(smr *r, int id, stats *s, int *c) {
+  unsigned long e = atomic_load(&r->epoch);
+  smr_list *l = &r->locals[id].retired[e % 3];
+  if (l->epoch != e) {
+    *c += smr_flush(r, id, l, s);
+    l->epoch = e;
+  }
+  return l;
+}
+
+#else
+
+// without reclamation nothing has to be tracked
+static void smr_enter(smr *r, int id) {}
+static void smr_exit(smr *r, int id) {}
+static void smr_hazard(smr *r, int id, int i, void *p) {}
+
+#endif
+
+#ifdef SMR_ENABLED
+
+// retire node, it gets reclaimed once no thread can access it anymore (including statistics, s may be NULL)
+static void smr_retire_stats(smr *r, int id, void *p, stats *s) {
+  smr_local *l = &r->locals[id];
+  int c = 0;
+  if (!smr_push(smr_list_of(r, id, s, &c), p)) {
+    return;  // node is leaked, buy more RAM
+  }
+  l->pending++;
+  l->retires++;
+  c += smr_scan(r, id, s);
+  l->pending -= c;
+  if (s != NULL) {
+    s->smr_reclaimed += c;
+    s->smr_pending = l->pending;
+  }
+}
+
+#else
+
+// retire node, it goes straight back to the pool (including statistics, s may be NULL)
+static void smr_retire_stats(smr *r, int id, void *p, stats *s) {
+  smr_release(r, id, p, s);
+}
+
+#endif
+
+// retire node
+static void smr_retire(smr *r, int id, void *p) {
+  smr_retire_stats(r, id, p, NULL);
+}
+
+// free all retired nodes (they are heap allocated when reclamation is enabled)
+static void smr_destroy(smr *r) {
+  if (r->locals == NULL) { return; }
+  for (int i = 0; i < r->max_threads; i++) {
+    for (int b = 0; b < 3; b++) {
+      for (int j = 0; j < r->locals[i].retired[b].len; j++) {
+        free(r->locals[i].retired[b].items[j]);
+      }
+      free(r->locals[i].retired[b].items);
+    }
+  }
+  free(r->locals);
+}
+
+#endif
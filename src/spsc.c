@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "queue.h"
+#include "wait.h"
+#include <omp.h>
+
+// single producer, single consumer ring (Lamport with cached indices, as in FastForward):
+// only one thread may enqueue and only one (possibly the same) thread may dequeue at a time.
+// every index has a single writer, so there is no atomic read-modify-write on the way;
+// release/acquire is enough (a seq_cst store would be an xchg on x86), deq_wait sleeps in slices therefore
+
+// capacity of the ring (has to be a power of two)
+#ifndef SPSC_SIZE
+#define SPSC_SIZE (1 << 20)
+#endif
+
+_Static_assert((SPSC_SIZE & (SPSC_SIZE - 1)) == 0, "SPSC_SIZE has to be a power of two");
+
+#define LOAD(p) atomic_load_explicit(p, memory_order_relaxed)
+#define ACQUIRE(p) atomic_load_explicit(p, memory_order_acquire)
+#define RELEASE(p, v) atomic_store_explicit(p, v, memory_order_release)
+
+// queue definition (each side caches the index of the other one and only rereads it when it seems to be stuck)
+typedef struct queue {
+  value_t *slots;
+  size_t mask;
+  PADDED _Atomic(size_t) head;
+  size_t tail_cache;
+  PADDED _Atomic(size_t) tail;
+  size_t head_cache;
+  waiter waiting;
+} queue;
+
+// free slots for the enqueuer (rereads head only if the cached one says less than n)
+static size_t room(queue *q, size_t t, size_t n) {
+  size_t avail = q->mask + 1 - (t - q->head_cache);
+  if (avail >= n) { return avail; }
+  q->head_cache = ACQUIRE(&q->head);
+  return q->mask + 1 - (t - q->head_cache);
+}
+
+// filled slots for the dequeuer (rereads tail only if the cached one says less than n)
+static size_t filled(queue *q, size_t h, size_t n) {
+  size_t full = q->tail_cache - h;
+  if (full >= n) { return full; }
+  q->tail_cache = ACQUIRE(&q->tail);
+  return q->tail_cache - h;
+}
+
+// create queue
+queue* create() {
+  queue *q = (queue*)calloc_padded(1, sizeof(queue));
+  if (!q) { return NULL; }  // buy more RAM
+  return q;
+}
+
+// initialize queue
+int init(queue *q) {
+  q->slots = (value_t*)calloc_padded(SPSC_SIZE, sizeof(value_t));
+  if (q->slots == NULL) { return QUEUE_NOMEM; }  // buy more RAM
+  q->mask = SPSC_SIZE - 1;
+  atomic_store(&q->head, 0);
+  atomic_store(&q->tail, 0);
+  q->head_cache = 0;
+  q->tail_cache = 0;
+  wait_init(&q->waiting);
+  return QUEUE_OK;
+}
+
+// enqueue in queue
+int enq(value_t v, queue *q) {
+  size_t t = LOAD(&q->tail);
+  if (room(q, t, 1) == 0) { return QUEUE_FULL; }
+  q->slots[t & q->mask] = v;
+  RELEASE(&q->tail, t + 1);
+  wait_wake(&q->waiting, 1);
+  return QUEUE_OK;
+}
+
+// enqueue in queue (including statistics)
+int enq_stats(value_t v, queue *q, stats *s) {
+  size_t t = LOAD(&q->tail);
+  if (room(q, t, 1) == 0) { return QUEUE_FULL; }
+  q->slots[t & q->mask] = v;
+  RELEASE(&q->tail, t + 1);
+  wait_wake_stats(&q->waiting, 1, s);
+  return QUEUE_OK;
+}
+
+// dequeue from queue
+int deq(value_t *v, queue *q) {
+  size_t h = LOAD(&q->head);
+  if (filled(q, h, 1) == 0) { return QUEUE_EMPTY; }
+  *v = q->slots[h & q->mask];
+  RELEASE(&q->head, h + 1);
+  return QUEUE_OK;
+}
+
+// dequeue from queue (including statistics)
+int deq_stats(value_t *v, queue *q, stats *s) {
+  return deq(v, q);
+}
+
+// enqueue multiple values in queue (returns number of enqueued values)
+int enq_batch(const value_t *vs, int n, queue *q) {
+  if (n <= 0) { return 0; }
+  size_t t = LOAD(&q->tail);
+  size_t avail = room(q, t, (size_t)n);
+  int c = avail < (size_t)n ? (int)avail : n;
+  for (int i = 0; i < c; i++) {
+    q->slots[(t + i) & q->mask] = vs[i];
+  }
+  RELEASE(&q->tail, t + c);
+  wait_wake(&q->waiting, c);
+  return c;
+}
+
+// enqueue multiple values in queue (including statistics)
+int enq_batch_stats(const value_t *vs, int n, queue *q, stats *s) {
+  if (n <= 0) { return 0; }
+  size_t t = LOAD(&q->tail);
+  size_t avail = room(q, t, (size_t)n);
+  int c = avail < (size_t)n ? (int)avail : n;
+  for (int i = 0; i < c; i++) {
+    q->slots[(t + i) & q->mask] = vs[i];
+  }
+  RELEASE(&q->tail, t + c);
+  wait_wake_stats(&q->waiting, c, s);
+  return c;
+}
+
+// dequeue up to max values from queue (returns number of dequeued values)
+int deq_batch(value_t *vs, int max, queue *q) {
+  if (max <= 0) { return 0; }
+  size_t h = LOAD(&q->head);
+  size_t full = filled(q, h, (size_t)max);
+  int c = full < (size_t)max ? (int)full : max;
+  for (int i = 0; i < c; i++) {
+    vs[i] = q->slots[(h + i) & q->mask];
+  }
+  RELEASE(&q->head, h + c);
+  return c;
+}
+
+// dequeue up to max values from queue (including statistics)
+int deq_batch_stats(value_t *vs, int max, queue *q, stats *s) {
+  return deq_batch(vs, max, q);
+}
+
+// dequeue from queue, sleep while it is empty (at most timeout seconds, forever if timeout < 0)
+int deq_wait(value_t *v, queue *q, double timeout) {
+  return wait_deq_sliced(&q->waiting, deq, v, q, timeout);
+}
+
+// dequeue from queue, sleep while it is empty (including statistics)
+int deq_wait_stats(value_t *v, queue *q, double timeout, stats *s) {
+  return wait_deq_sliced_stats(&q->waiting, deq_stats, v, q, timeout, s);
+}
+
+// length of queue
+int len(queue *q) {
+  size_t head = atomic_load(&q->head);
+  return (int)(atomic_load(&q->tail) - head);
+}
+
+// destroy queue
+void destroy(queue *q) {
+  free(q->slots);
+  free(q);
+}
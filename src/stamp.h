@@ -0,0 +1,108 @@
+#ifndef STAMP_H
+#define STAMP_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// stamped pointer: pointer plus a counter bumped on every swap against ABA
+// default: 16 bit stamp in the upper bits of a 64 bit word (wraps quickly, needs 48 bit addresses)
+// -DDWCAS: 64 bit stamp next to the pointer, swapped together with cmpxchg16b (needs -mcx16)
+#ifdef DWCAS
+
+#ifndef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_16
+#error "DWCAS needs a 16 byte compare and swap (build with -mcx16)"
+#endif
+
+// stamp
+typedef uint64_t stamp_t;
+
+// stamped pointer (value)
+typedef unsigned __int128 sptr;
+
+// stamped pointer (shared location, both halves get swapped at once)
+typedef struct asptr {
+  _Alignas(16) _Atomic(uint64_t) ptr;
+  _Atomic(uint64_t) stamp;
+} asptr;
+
+// stamp pointer
+static sptr stamp(void *p, stamp_t s) {
+  return ((sptr)s << 64) | (uintptr_t)p;
+}
+
+// get stamp from stamped pointer
+static stamp_t get_stamp(sptr sp) {
+  return (stamp_t)(sp >> 64);
+}
+
+// get pointer from stamped pointer
+static void *get_ptr(sptr sp) {
+  return (void*)(uintptr_t)sp;
+}
+
+// read stamped pointer; the stamp is read first, so a torn read pairs a pointer with an older stamp
+// and can never match the location again (stamps only grow)
+static sptr sptr_load(asptr *src) {
+  stamp_t s = atomic_load(&src->stamp);
+  uintptr_t p = atomic_load(&src->ptr);
+  return ((sptr)s << 64) | p;
+}
+
+// compare and swap stamped pointer (expected gets updated on failure)
+static int sptr_cas(asptr *dst, sptr *expected, sptr desired) {
+  sptr old = __sync_val_compare_and_swap((sptr*)dst, *expected, desired);
+  if (old == *expected) { return 1; }
+  *expected = old;
+  return 0;
+}
+
+// write stamped pointer (both halves at once)
+static void sptr_store(asptr *dst, sptr sp) {
+  sptr old = sptr_load(dst);
+  while (!sptr_cas(dst, &old, sp));
+}
+
+#else
+
+// stamp
+typedef uint16_t stamp_t;
+
+// stamped pointer (value)
+typedef uint64_t sptr;
+
+// stamped pointer (shared location)
+typedef _Atomic(sptr) asptr;
+
+// stamp pointer
+static sptr stamp(void *p, stamp_t s) {
+  return ((sptr)s << 48) | ((sptr)p & 0x0000FFFFFFFFFFFF);
+}
+
+// get stamp from stamped pointer
+static stamp_t get_stamp(sptr sp) {
+  return (stamp_t)(sp >> 48);
+}
+
+// get pointer from stamped pointer
+static void *get_ptr(sptr sp) {
+  return (void*)(sp & 0x0000FFFFFFFFFFFF);
+}
+
+// read stamped pointer
+static sptr sptr_load(asptr *src) {
+  return atomic_load(src);
+}
+
+// compare and swap stamped pointer (expected gets updated on failure)
+static int sptr_cas(asptr *dst, sptr *expected, sptr desired) {
+  return atomic_compare_exchange_weak(dst, expected, desired);
+}
+
+// write stamped pointer
+static void sptr_store(asptr *dst, sptr sp) {
+  atomic_store(dst, sp);
+}
+
+#endif
+
+#endif
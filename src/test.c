@@ -1,9 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <malloc.h>
 #include "queue.h"
 #include <omp.h>
 
+// flags of the variant under test (QUEUE_SEQUENTIAL, QUEUE_SP, QUEUE_SC), concurrent tests stay within its contract
+#ifndef QUEUE_ONLY_FLAGS
+#define QUEUE_ONLY_FLAGS 0
+#endif
+
 // test sequential implementaion
 int test_seq(const int N) {
   printf("Doing sequential tests...\n");
@@ -19,7 +23,7 @@ int test_seq(const int N) {
   }
 
   for (int i = 0; i < N; i++) {
-    ret = enq((value_t)i, q);
+    ret = enq(VALUE(i), q);
     if (ret != QUEUE_OK) {
       printf(" ERROR on enq(%d): %s\n", i, q_error(ret));
       destroy(q);
@@ -42,8 +46,8 @@ int test_seq(const int N) {
       destroy(q);
       return 1;
     }
-    if (v != (value_t)i) {
-      printf(" ERROR: enq(%d) and deq(%d) do not match\n", i, (int)v);
+    if (KEY(v) != i) {
+      printf(" ERROR: enq(%d) and deq(%d) do not match\n", i, KEY(v));
       return 1;
     }
   }
@@ -74,7 +78,7 @@ int test_seq(const int N) {
   printf(" Empty dequeue test passed\n");
 
   for (int i = 0; i < N; i++) {
-    ret = enq((value_t)i, q);
+    ret = enq(VALUE(i), q);
     if (ret != QUEUE_OK) {
       printf(" ERROR on enq(%d): %s\n", i, q_error(ret));
       destroy(q);
@@ -86,8 +90,8 @@ int test_seq(const int N) {
       destroy(q);
       return 1;
     }
-    if (v != (value_t)i) {
-      printf(" ERROR: enq(%d) and deq(%d) do not match\n", i, (int)v);
+    if (KEY(v) != i) {
+      printf(" ERROR: enq(%d) and deq(%d) do not match\n", i, KEY(v));
       destroy(q);
       return 1;
     }
@@ -130,7 +134,7 @@ int test_conc(const int N) {
 
   #pragma omp parallel for
   for (int i = 0; i < N; i++) {
-    int r = enq((value_t)i, q);
+    int r = enq(VALUE(i), q);
     if (r != QUEUE_OK) {
       #pragma omp critical
       printf(" ERROR on enq(): %s\n", q_error(r));
@@ -179,7 +183,7 @@ int test_conc(const int N) {
   printf(" Empty dequeue test passed\n");
 
   for (int i = 0; i < N; i++) {
-    int r = enq((value_t)i, q);
+    int r = enq(VALUE(i), q);
     if (r != QUEUE_OK) {
       printf(" ERROR on enq(): %s\n", q_error(r));
     }
@@ -211,7 +215,7 @@ int test_conc(const int N) {
 
   #pragma omp parallel for
   for (int i = 0; i < N; i++) {
-    int r = enq((value_t)i, q);
+    int r = enq(VALUE(i), q);
     if (r != QUEUE_OK) {
       #pragma omp critical
       printf(" ERROR on enq(): %s\n", q_error(r));
@@ -244,7 +248,7 @@ int test_conc(const int N) {
 
   #pragma omp parallel for
   for (int i = 0; i < N; i++) {
-    int r = enq((value_t)i, q);
+    int r = enq(VALUE(i), q);
     if (r != QUEUE_OK) {
       #pragma omp critical
       printf(" ERROR on enq(): %s\n", q_error(r));
@@ -259,10 +263,10 @@ int test_conc(const int N) {
 
   int *vs = calloc(N+1, sizeof(int));
   while((ret = deq(&v, q)) == QUEUE_OK) {
-    if (v < 0 || v > N) {
-      printf(" ERROR: deq(%d) out of range\n", (int)v);
+    if (KEY(v) < 0 || KEY(v) > N) {
+      printf(" ERROR: deq(%d) out of range\n", KEY(v));
     } else {
-      vs[(int)v]++;
+      vs[KEY(v)]++;
     }
   }
 
@@ -287,7 +291,7 @@ int test_conc(const int N) {
   #pragma omp parallel for
   for (int i = 0; i < N; i++) {
     if (omp_get_thread_num() % 2) {
-      int r = enq((value_t)i, q);
+      int r = enq(VALUE(i), q);
       if (r != QUEUE_OK) {
         #pragma omp critical
         printf(" ERROR on enq(): %s\n", q_error(r));
@@ -310,7 +314,7 @@ int test_conc(const int N) {
 
   #pragma omp parallel for
   for (int i = 0; i < N; i++) {
-    int r = enq((value_t)i, q);
+    int r = enq(VALUE(i), q);
     if (r != QUEUE_OK) {
       #pragma omp critical
       printf(" ERROR on enq(): %s\n", q_error(r));
@@ -345,11 +349,503 @@ int test_conc(const int N) {
   return 0;
 }
 
+// test single producer or single consumer implementation within its contract:
+// one producer and the other threads consume (QUEUE_SP), the other way round (QUEUE_SC) or one each (QUEUE_SPSC)
+int test_single(const int N) {
+  printf("Doing single producer/consumer tests...\n");
+
+  if (omp_get_max_threads() < 2) {
+    printf(" Skipping tests, they need 2 threads\n");
+    return 0;
+  }
+
+  const int B = 100;
+  const int threads = QUEUE_ONLY_FLAGS == QUEUE_SPSC ? 2 : omp_get_max_threads();
+  const int P = QUEUE_ONLY_FLAGS & QUEUE_SP ? 1 : threads - 1;
+  const int M = N / P * P;  // producer p enqueues the keys k * P + p
+  queue *q = create();
+  value_t v;
+
+  int ret = init(q);
+  if (ret != QUEUE_OK) {
+    printf(" ERROR on init(): %s\n", q_error(ret));
+    destroy(q);
+    return 1;
+  }
+
+  int *counts = malloc(sizeof(int) * M);
+  if (counts == NULL) {
+    printf(" ERROR: Unable to allocate counts. Buy more RAM\n");
+    destroy(q);
+    return 1;
+  }
+
+  for (int batch = 0; batch < 2; batch++) {
+    int done = 0;
+    int errors = 0;
+    for (int i = 0; i < M; i++) {
+      counts[i] = 0;
+    }
+
+    #pragma omp parallel num_threads(threads) reduction(+:errors)
+    {
+      int id = omp_get_thread_num();
+      value_t ws[B];
+      if (id < P) {
+        // a full queue is no error here, the consumers make room again
+        int k = 0;
+        while (k < M / P) {
+          if (batch) {
+            int n = M / P - k < B ? M / P - k : B;
+            for (int j = 0; j < n; j++) {
+              ws[j] = VALUE((k + j) * P + id);
+            }
+            k += enq_batch(ws, n, q);
+          } else if (enq(VALUE(k * P + id), q) == QUEUE_OK) {
+            k++;
+          }
+        }
+        #pragma omp atomic
+        done++;
+      } else {
+        // values of a producer have to arrive in its order, also if another consumer takes some in between
+        int last[P];
+        for (int p = 0; p < P; p++) {
+          last[p] = -1;
+        }
+        // stop once all producers are done and the queue is drained, so a lost value fails instead of hanging
+        while (1) {
+          int d;
+          #pragma omp atomic read
+          d = done;
+          int c = batch ? deq_batch(ws, B, q) : (deq(&ws[0], q) == QUEUE_OK);
+          for (int j = 0; j < c; j++) {
+            int key = KEY(ws[j]);
+            if (key < 0 || key >= M) {
+              if (errors++ == 0) {
+                #pragma omp critical
+                printf(" ERROR: %s(%d) out of range\n", batch ? "deq_batch" : "deq", key);
+              }
+              continue;
+            }
+            #pragma omp atomic
+            counts[key]++;
+            if (key / P <= last[key % P] && errors++ == 0) {
+              #pragma omp critical
+              printf(" ERROR: %s(%d) after %s(%d) of the same producer\n", batch ? "deq_batch" : "deq", key,
+                     batch ? "deq_batch" : "deq", last[key % P] * P + key % P);
+            }
+            last[key % P] = key / P;
+          }
+          if (c == 0 && d == P) { break; }
+        }
+      }
+    }
+
+    for (int i = 0; i < M && errors == 0; i++) {
+      if (counts[i] != 1) {
+        printf(" ERROR: value %d occurs %d times\n", i, counts[i]);
+        errors++;
+      }
+    }
+
+    if (errors > 0 || len(q) != 0) {
+      printf(" ERROR: %d errors with %d producers and %d consumers, queue length %d\n", errors, P, threads - P, len(q));
+      free(counts);
+      destroy(q);
+      return 1;
+    }
+
+    printf(" %s enqueue and dequeue test with %d producers and %d consumers passed\n", batch ? "Concurrent batch" : "Concurrent",
+           P, threads - P);
+  }
+
+  free(counts);
+
+  ret = deq(&v, q);
+  if (ret != QUEUE_EMPTY) {
+    printf(" ERROR: deq() should return QUEUE_EMPTY, returned %s\n", q_error(ret));
+    destroy(q);
+    return 1;
+  }
+
+  destroy(q);
+
+  printf(" All single producer/consumer tests passed\n");
+  return 0;
+}
+
+// test blocking dequeue: timeout on an empty queue, wakeup by an enqueue of another thread and recovery of missed wakeups
+int test_wait(const int N) {
+  printf("Doing blocking dequeue tests...\n");
+
+  const double timeout = 0.05;
+  queue *q = create();
+  value_t v;
+
+  int ret = init(q);
+  if (ret != QUEUE_OK) {
+    printf(" ERROR on init(): %s\n", q_error(ret));
+    destroy(q);
+    return 1;
+  }
+
+  double start = omp_get_wtime();
+  ret = deq_wait(&v, q, timeout);
+  double took = omp_get_wtime() - start;
+  if (ret != QUEUE_EMPTY) {
+    printf(" ERROR: deq_wait() on an empty queue should return QUEUE_EMPTY, returned %s\n", q_error(ret));
+    destroy(q);
+    return 1;
+  }
+  // a busy box may oversleep, but it must not give up early or sleep forever
+  if (took < timeout * 0.9 || took > timeout + 1.0) {
+    printf(" ERROR: deq_wait(%.3f) on an empty queue returned after %.3f seconds\n", timeout, took);
+    destroy(q);
+    return 1;
+  }
+
+  printf(" Timeout test passed\n");
+
+  if ((QUEUE_ONLY_FLAGS & QUEUE_SEQUENTIAL) || omp_get_max_threads() < 2) {
+    destroy(q);
+    printf(" All blocking dequeue tests passed\n");
+    return 0;
+  }
+
+  // thread 0 enqueues and thread 1 dequeues, which keeps every variant within its contract
+  for (int missed = 0; missed < 2; missed++) {
+    const int R = missed ? N : 20;
+    int waiting = -1;
+    int errors = 0;
+
+    #pragma omp parallel num_threads(2) reduction(+:errors)
+    {
+      if (omp_get_thread_num() == 0) {
+        for (int r = 0; r < R; r++) {
+          int w;
+          do {
+            #pragma omp atomic read
+            w = waiting;
+          } while (w < r);
+          if (w == R) { break; }
+          // let the dequeuer go to sleep first, or enqueue right away to hit it while it registers as sleeper
+          if (!missed) {
+            double until = omp_get_wtime() + 2e-3;
+            while (omp_get_wtime() < until) {}
+          }
+          while (enq(VALUE(r), q) != QUEUE_OK) {}
+        }
+      } else {
+        for (int r = 0; r < R && errors == 0; r++) {
+          #pragma omp atomic write
+          waiting = r;
+          double start = omp_get_wtime();
+          // a missed wakeup shows as a wait close to the timeout instead of a hang
+          int ret = deq_wait(&v, q, missed ? 5.0 : -1.0);
+          double took = omp_get_wtime() - start;
+          if (ret != QUEUE_OK || KEY(v) != r) {
+            printf(" ERROR: deq_wait() returned %s with %d instead of %d\n", q_error(ret), KEY(v), r);
+            errors++;
+          } else if (took > 1.0) {
+            printf(" ERROR: deq_wait() took %.3f seconds to see enq(%d)\n", took, r);
+            errors++;
+          }
+        }
+        // release the enqueuer after an error
+        #pragma omp atomic write
+        waiting = R;
+      }
+    }
+
+    if (errors > 0) {
+      destroy(q);
+      return 1;
+    }
+
+    printf(" %s test passed\n", missed ? "Missed wakeup" : "Wakeup");
+  }
+
+  destroy(q);
+
+  printf(" All blocking dequeue tests passed\n");
+  return 0;
+}
+
+// test bounded implementation with capacity C: full queue, short batches and reuse after draining
+int test_full(const int C) {
+  printf("Doing full queue tests...\n");
+
+  const int B = 10;
+  queue *q = create();
+  value_t *vs = (value_t*)malloc(sizeof(value_t) * 2 * B);
+  value_t v;
+
+  int ret = init(q);
+  if (ret != QUEUE_OK) {
+    printf(" ERROR on init(): %s\n", q_error(ret));
+    free(vs);
+    destroy(q);
+    return 1;
+  }
+
+  for (int i = 0; i < C; i++) {
+    ret = enq(VALUE(i), q);
+    if (ret != QUEUE_OK) {
+      printf(" ERROR on enq(%d) below capacity %d: %s\n", i, C, q_error(ret));
+      free(vs);
+      destroy(q);
+      return 1;
+    }
+  }
+
+  ret = enq(VALUE(C), q);
+  if (ret != QUEUE_FULL || len(q) != C) {
+    printf(" ERROR: enq() on a full queue should return QUEUE_FULL, returned %s, queue length %d\n", q_error(ret), len(q));
+    free(vs);
+    destroy(q);
+    return 1;
+  }
+
+  printf(" Full enqueue test passed\n");
+
+  // make room for B values, then try to enqueue 2 * B
+  for (int i = 0; i < B; i++) {
+    deq(&v, q);
+  }
+  for (int j = 0; j < 2 * B; j++) {
+    vs[j] = VALUE(C + j);
+  }
+  int c = enq_batch(vs, 2 * B, q);
+  int d = enq_batch(vs + c, 2 * B - c, q);
+  if (c != B || d != 0 || len(q) != C) {
+    printf(" ERROR: enq_batch(%d) with room for %d enqueued %d and %d values, queue length %d\n", 2 * B, B, c, d, len(q));
+    free(vs);
+    destroy(q);
+    return 1;
+  }
+
+  printf(" Full batch enqueue test passed\n");
+
+  int n = B;
+  while (deq(&v, q) == QUEUE_OK) {
+    if (KEY(v) != n) {
+      printf(" ERROR: enq(%d) and deq(%d) do not match\n", n, KEY(v));
+      free(vs);
+      destroy(q);
+      return 1;
+    }
+    n++;
+  }
+
+  if (n != C + B || len(q) != 0) {
+    printf(" ERROR: dequeued %d of %d values, queue length %d\n", n - B, C, len(q));
+    free(vs);
+    destroy(q);
+    return 1;
+  }
+
+  // the slots have to be usable again, also across the wrap around
+  for (int i = 0; i < 3 * C; i++) {
+    ret = enq(VALUE(i), q);
+    if (ret != QUEUE_OK) {
+      printf(" ERROR on enq(%d) after draining: %s\n", i, q_error(ret));
+      free(vs);
+      destroy(q);
+      return 1;
+    }
+    if (i % 2 == 0) { continue; }
+    for (int j = i - 1; j <= i; j++) {
+      ret = deq(&v, q);
+      if (ret != QUEUE_OK || KEY(v) != j) {
+        printf(" ERROR: deq() after draining returned %s with %d instead of %d\n", q_error(ret), KEY(v), j);
+        free(vs);
+        destroy(q);
+        return 1;
+      }
+    }
+  }
+
+  printf(" Reuse after draining test passed\n");
+
+  // producers retry on a full queue while consumers make room
+  if (omp_get_max_threads() >= 2) {
+    const int N = 100 * C;
+    int *counts = calloc(N, sizeof(int));
+    int next = 0;
+    int taken = 0;
+
+    #pragma omp parallel
+    {
+      int id = omp_get_thread_num();
+      int t;
+      if (id % 2 == 0) {
+        int k;
+        while (1) {
+          #pragma omp atomic capture
+          k = next++;
+          if (k >= N) { break; }
+          while (enq(VALUE(k), q) == QUEUE_FULL) {}
+        }
+      } else {
+        do {
+          value_t w;
+          if (deq(&w, q) == QUEUE_OK) {
+            #pragma omp atomic
+            counts[KEY(w)]++;
+            #pragma omp atomic
+            taken++;
+          }
+          #pragma omp atomic read
+          t = taken;
+        } while (t < N);
+      }
+    }
+
+    for (int i = 0; i < N; i++) {
+      if (counts[i] != 1) {
+        printf(" ERROR: value %d occurs %d times\n", i, counts[i]);
+        free(counts);
+        free(vs);
+        destroy(q);
+        return 1;
+      }
+    }
+    free(counts);
+
+    printf(" Parallel enqueue on a full queue test passed\n");
+  }
+
+  free(vs);
+  destroy(q);
+
+  printf(" All full queue tests passed\n");
+  return 0;
+}
+
+// test batch operations
+int test_batch(const int N) {
+  printf("Doing batch tests...\n");
+
+  const int B = 100;
+  queue *q = create();
+  value_t *vs = (value_t*)malloc(sizeof(value_t) * B);
+
+  int ret = init(q);
+  if (ret != QUEUE_OK) {
+    printf(" ERROR on init(): %s\n", q_error(ret));
+    free(vs);
+    destroy(q);
+    return 1;
+  }
+
+  for (int i = 0; i < N; i += B) {
+    int n = N - i < B ? N - i : B;
+    for (int j = 0; j < n; j++) {
+      vs[j] = VALUE(i + j);
+    }
+    int c = enq_batch(vs, n, q);
+    if (c != n) {
+      printf(" ERROR: enq_batch(%d) enqueued only %d values\n", n, c);
+      free(vs);
+      destroy(q);
+      return 1;
+    }
+  }
+
+  if (len(q) != N) {
+    printf(" ERROR: queue length should be %d (!= %d)\n", N, len(q));
+    free(vs);
+    destroy(q);
+    return 1;
+  }
+
+  printf(" Batch enqueue test passed\n");
+
+  int i = 0;
+  int c;
+  while ((c = deq_batch(vs, B, q)) > 0) {
+    for (int j = 0; j < c; j++, i++) {
+      if (KEY(vs[j]) != i) {
+        printf(" ERROR: enq(%d) and deq_batch(%d) do not match\n", i, KEY(vs[j]));
+        free(vs);
+        destroy(q);
+        return 1;
+      }
+    }
+  }
+
+  if (i != N || len(q) != 0) {
+    printf(" ERROR: dequeued %d of %d values, queue length %d\n", i, N, len(q));
+    free(vs);
+    destroy(q);
+    return 1;
+  }
+
+  printf(" Batch dequeue test passed\n");
+
+  // concurrent batches of restricted variants are covered by their own tests
+  if (QUEUE_ONLY_FLAGS != 0) {
+    free(vs);
+    destroy(q);
+    printf(" All batch tests passed\n");
+    return 0;
+  }
+
+  #pragma omp parallel for
+  for (int i = 0; i < N; i += B) {
+    value_t ws[B];
+    int n = N - i < B ? N - i : B;
+    for (int j = 0; j < n; j++) {
+      ws[j] = VALUE(i + j);
+    }
+    int c = enq_batch(ws, n, q);
+    if (c != n) {
+      #pragma omp critical
+      printf(" ERROR: enq_batch(%d) enqueued only %d values\n", n, c);
+    }
+  }
+
+  int *counts = calloc(N, sizeof(int));
+  #pragma omp parallel
+  {
+    value_t ws[B];
+    int c;
+    while ((c = deq_batch(ws, B, q)) > 0) {
+      for (int j = 0; j < c; j++) {
+        if (KEY(ws[j]) < 0 || KEY(ws[j]) >= N) {
+          #pragma omp critical
+          printf(" ERROR: deq_batch(%d) out of range\n", KEY(ws[j]));
+        } else {
+          #pragma omp atomic
+          counts[KEY(ws[j])]++;
+        }
+      }
+    }
+  }
+
+  for (int i = 0; i < N; i++) {
+    if (counts[i] != 1) {
+      printf(" ERROR: value %d occurs %d times\n", i, counts[i]);
+      free(counts);
+      free(vs);
+      destroy(q);
+      return 1;
+    }
+  }
+  free(counts);
+
+  printf(" Parallel batch enqueue and dequeue test passed\n");
+
+  free(vs);
+  destroy(q);
+
+  printf(" All batch tests passed\n");
+  return 0;
+}
+
 // test sequential and concurrent implementaion and print some test/usage
 int main(int argc, char** argv) {
-  // decrease malloc arena count; otherwise nebula cannot do s.... as RAM goes brrrrrr for > 50 threads
-  mallopt(M_ARENA_MAX, 1);
-
   // get number of threads
   if (argc > 1) {
     int threads = atoi(argv[1]);
@@ -373,7 +869,7 @@ int main(int argc, char** argv) {
 
   printf(" Enqueuing: ");
   for (int i = 0; i < N; i++) {
-    enq((value_t)i, q);
+    enq(VALUE(i), q);
     printf("%d ", i);
   }
   printf("\n");
@@ -382,7 +878,7 @@ int main(int argc, char** argv) {
 
   printf(" Dequeuing: ");
   while(deq(&v, q) == 0) {
-    printf("%d ", (int)v);
+    printf("%d ", KEY(v));
   }
   printf("\n");
 
@@ -390,11 +886,24 @@ int main(int argc, char** argv) {
 
   destroy(q);
 
-  // testing queue
+  // testing queue (a bounded ring built small holds fewer elements)
+#ifdef RING_SIZE
+  const int T = RING_SIZE;
+#else
   const int T = 1E6;
+#endif
   printf("Testing with %d elements\n", T);
   test_seq(T);
-  test_conc(T);
+  if (QUEUE_ONLY_FLAGS & QUEUE_SPSC) {
+    test_single(T);
+  } else if (QUEUE_ONLY_FLAGS == 0) {
+    test_conc(T);
+  }
+  test_batch(T);
+  test_wait(T / 1000);
+#ifdef RING_SIZE
+  test_full(RING_SIZE);
+#endif
 
   return 0;
 }
@@ -0,0 +1,159 @@
+#ifndef WAIT_H
+#define WAIT_H
+
+#include <stdatomic.h>
+#include <time.h>
+#include "queue.h"
+#include <omp.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <sched.h>
+#endif
+
+// empty dequeue attempts of a waiting dequeuer before it goes to sleep
+#ifndef WAIT_SPINS
+#define WAIT_SPINS 128
+#endif
+
+// longest sleep in seconds of a dequeuer on a queue whose enqueuers may miss it (see wait_deq_sliced)
+#ifndef WAIT_SLICE
+#define WAIT_SLICE 1e-3
+#endif
+
+// sleeping dequeuers of a queue (enqueuers only touch the futex word if somebody sleeps)
+typedef struct waiter {
+  PADDED _Atomic(int) seq;
+  _Atomic(double) woken_at;
+  PADDED _Atomic(int) sleepers;
+} waiter;
+
+// initialize waiter
+static void wait_init(waiter *w) {
+  atomic_store(&w->seq, 0);
+  atomic_store(&w->woken_at, 0.0);
+  atomic_store(&w->sleepers, 0);
+}
+
+// sleep as long as the futex word is val (at most timeout seconds, forever if timeout < 0)
+static void futex_wait(_Atomic(int) *addr, int val, double timeout) {
+#ifdef __linux__
+  struct timespec ts;
+  struct timespec *t = NULL;
+  if (timeout >= 0) {
+    ts.tv_sec = (time_t)timeout;
+    ts.tv_nsec = (long)((timeout - (double)ts.tv_sec) * 1e9);
+    t = &ts;
+  }
+  syscall(SYS_futex, (int*)addr, FUTEX_WAIT_PRIVATE, val, t, NULL, 0);
+#else
+  sched_yield();  // no futex, degrade to polling
+#endif
+}
+
+// wake up to n threads sleeping on the futex word
+static void futex_wake(_Atomic(int) *addr, int n) {
+#ifdef __linux__
+  syscall(SYS_futex, (int*)addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+#endif
+}
+
+// wake up to n sleeping dequeuers after a successful enqueue (a single load while nobody sleeps)
+static void wait_wake(waiter *w, int n) {
+  if (n <= 0 || atomic_load(&w->sleepers) == 0) { return; }
+  atomic_fetch_add(&w->seq, 1);
+  futex_wake(&w->seq, n);
+}
+
+// wake up to n sleeping dequeuers after a successful enqueue (including statistics)
+static void wait_wake_stats(waiter *w, int n, stats *s) {
+  if (n <= 0 || atomic_load(&w->sleepers) == 0) { return; }
+  atomic_store(&w->woken_at, omp_get_wtime());
+  atomic_fetch_add(&w->seq, 1);
+  futex_wake(&w->seq, n);
+  s->wake_calls++;
+}
+
+// dequeue with try_deq; while the queue is empty spin for a bit, then sleep until an enqueuer wakes us
+// (gives up after timeout seconds, never if timeout < 0)
+static int wait_deq(waiter *w, int (*try_deq)(value_t*, queue*), value_t *v, queue *q, double timeout) {
+  int ret = try_deq(v, q);
+  for (int i = 0; i < WAIT_SPINS && ret == QUEUE_EMPTY; i++) {
+    ret = try_deq(v, q);
+  }
+  double end = omp_get_wtime() + timeout;
+  while (ret == QUEUE_EMPTY) {
+    int seq = atomic_load(&w->seq);
+    atomic_fetch_add(&w->sleepers, 1);
+    // enqueuers that did not see us as sleeper yet have to be visible now
+    ret = try_deq(v, q);
+    if (ret == QUEUE_EMPTY) {
+      double left = timeout < 0 ? -1.0 : end - omp_get_wtime();
+      if (timeout >= 0 && left <= 0) {
+        atomic_fetch_sub(&w->sleepers, 1);
+        return QUEUE_EMPTY;
+      }
+      futex_wait(&w->seq, seq, left);
+      ret = try_deq(v, q);
+    }
+    atomic_fetch_sub(&w->sleepers, 1);
+  }
+  return ret;
+}
+
+// dequeue with try_deq, sleep while the queue is empty (including statistics)
+static int wait_deq_stats(waiter *w, int (*try_deq)(value_t*, queue*, stats*), value_t *v, queue *q, double timeout, stats *s) {
+  int ret = try_deq(v, q, s);
+  for (int i = 0; i < WAIT_SPINS && ret == QUEUE_EMPTY; i++) {
+    s->wait_spins++;
+    ret = try_deq(v, q, s);
+  }
+  double end = omp_get_wtime() + timeout;
+  while (ret == QUEUE_EMPTY) {
+    int seq = atomic_load(&w->seq);
+    atomic_fetch_add(&w->sleepers, 1);
+    // enqueuers that did not see us as sleeper yet have to be visible now
+    ret = try_deq(v, q, s);
+    if (ret == QUEUE_EMPTY) {
+      double left = timeout < 0 ? -1.0 : end - omp_get_wtime();
+      if (timeout >= 0 && left <= 0) {
+        atomic_fetch_sub(&w->sleepers, 1);
+        return QUEUE_EMPTY;
+      }
+      s->wait_parks++;
+      futex_wait(&w->seq, seq, left);
+      if (atomic_load(&w->seq) != seq) {
+        s->wait_woken++;
+        s->wait_latency_ns += (long)((omp_get_wtime() - atomic_load(&w->woken_at)) * 1e9);
+      }
+      ret = try_deq(v, q, s);
+    }
+    atomic_fetch_sub(&w->sleepers, 1);
+  }
+  return ret;
+}
+
+// wait_deq for queues whose enqueuers publish with a release store and look for sleepers without a fence:
+// such an enqueuer may miss a dequeuer that is just going to sleep, so sleeps are cut into slices of WAIT_SLICE
+static int wait_deq_sliced(waiter *w, int (*try_deq)(value_t*, queue*), value_t *v, queue *q, double timeout) {
+  double end = omp_get_wtime() + timeout;
+  while(1) {
+    double left = timeout < 0 ? WAIT_SLICE : end - omp_get_wtime();
+    int ret = wait_deq(w, try_deq, v, q, left < WAIT_SLICE ? left : WAIT_SLICE);
+    if (ret != QUEUE_EMPTY || (timeout >= 0 && omp_get_wtime() >= end)) { return ret; }
+  }
+}
+
+// wait_deq_sliced (including statistics)
+static int wait_deq_sliced_stats(waiter *w, int (*try_deq)(value_t*, queue*, stats*), value_t *v, queue *q, double timeout, stats *s) {
+  double end = omp_get_wtime() + timeout;
+  while(1) {
+    double left = timeout < 0 ? WAIT_SLICE : end - omp_get_wtime();
+    int ret = wait_deq_stats(w, try_deq, v, q, left < WAIT_SLICE ? left : WAIT_SLICE, s);
+    if (ret != QUEUE_EMPTY || (timeout >= 0 && omp_get_wtime() >= end)) { return ret; }
+  }
+}
+
+#endif